@@ -0,0 +1,392 @@
+/*
+ * Microbenchmarks of the hot paths of mx-ui.
+ *
+ * Every benchmark is run for at least `--min-time` seconds a few times and the
+ * median is reported, one JSON object per line, so two runs can be diffed or
+ * loaded into anything that reads JSON lines.
+ * The inputs come from a fixed seed, so runs are comparable across versions.
+ * Configure with `-DCMAKE_BUILD_TYPE=Release`, the default flags don't optimize.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "BatchDecoder.h"
+#include "Diagnostics.h"
+#include "Frame.h"
+#include "FrameDecoder.h"
+#include "History.h"
+#include "PlotData.h"
+#include "CsvExporter.h"
+#include "CsvImporter.h"
+#include "Trigger.h"
+
+// Keeps the compiler from optimizing the measured work away
+template <typename T>
+static inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchOptions
+{
+    std::string filter;
+    double minTime = 0.2;
+    int repetitions = 5;
+};
+
+class BenchRunner
+{
+public:
+    // Runs a batch and returns the number of items it processed
+    using BatchFunc = std::function<size_t()>;
+
+    explicit BenchRunner(const BenchOptions& options)
+        : options{options}
+    {
+    }
+
+    // `bytesPerItem` is only used to report the throughput, zero leaves it out
+    void run(const std::string& name, size_t param, BatchFunc batch, double bytesPerItem=0)
+    {
+        const std::string fullName = name+'/'+std::to_string(param);
+        if (fullName.find(options.filter) == std::string::npos)
+            return;
+
+        // Warm up the caches and find out how many batches fill the time
+        using clock = std::chrono::steady_clock;
+        size_t batchCount = 1;
+        for (;;)
+        {
+            const auto start = clock::now();
+            for (size_t i{}; i < batchCount; ++i)
+                doNotOptimize(batch());
+            if (std::chrono::duration<double>(clock::now()-start).count() >= options.minTime/4)
+                break;
+            batchCount *= 2;
+        }
+
+        std::vector<double> nsPerItem;
+        size_t items{};
+        for (int rep{}; rep < options.repetitions; ++rep)
+        {
+            items = 0;
+            const auto start = clock::now();
+            do
+            {
+                for (size_t i{}; i < batchCount; ++i)
+                    items += batch();
+            } while (std::chrono::duration<double>(clock::now()-start).count() < options.minTime);
+            nsPerItem.push_back(std::chrono::duration<double, std::nano>(clock::now()-start).count()/items);
+        }
+        std::sort(nsPerItem.begin(), nsPerItem.end());
+        const double median = nsPerItem[nsPerItem.size()/2];
+
+        std::printf("{\"name\":\"%s\",\"param\":%zu,\"items\":%zu,\"ns_per_item\":%.3f,\"min_ns_per_item\":%.3f,"
+                "\"max_ns_per_item\":%.3f,\"items_per_s\":%.1f",
+                name.c_str(), param, items, median, nsPerItem.front(), nsPerItem.back(), 1e9/median);
+        if (bytesPerItem > 0)
+            std::printf(",\"bytes_per_s\":%.1f", bytesPerItem*1e9/median);
+        std::printf("}\n");
+        std::fflush(stdout);
+    }
+
+    // Reports a measured quantity that isn't a time, like a size
+    void report(const std::string& name, size_t param, const char* key, double value)
+    {
+        const std::string fullName = name+'/'+std::to_string(param);
+        if (fullName.find(options.filter) == std::string::npos)
+            return;
+
+        std::printf("{\"name\":\"%s\",\"param\":%zu,\"%s\":%.3f}\n", name.c_str(), param, key, value);
+        std::fflush(stdout);
+    }
+
+private:
+    const BenchOptions& options;
+};
+
+// A meter wandering around with random units and flags, like a real session
+static std::vector<std::array<uint8_t, 14>> makeFrames(size_t count, uint32_t seed)
+{
+    std::mt19937 rng{seed};
+    std::normal_distribution<float> step{0, 0.05f};
+    std::vector<std::array<uint8_t, 14>> frames;
+    frames.reserve(count);
+    float value{};
+    Frame::Unit unit{Frame::Unit::Prefix::None, Frame::Unit::Base::Volt};
+    for (size_t i{}; i < count; ++i)
+    {
+        value += step(rng);
+        if (rng() % 1000 == 0)
+            unit = {Frame::Unit::Prefix(rng() % 6), Frame::Unit::Base(rng() % 7)};
+        // Overloads now and then
+        frames.push_back(Frame::encode(rng() % 500 ? value : NAN, unit, rng() % 2, rng() % 4));
+    }
+    return frames;
+}
+
+static History makeHistory(size_t count)
+{
+    const auto frames = makeFrames(count, 2);
+    History history;
+    timestamp_t ts{std::chrono::seconds{1'700'000'000}};
+    for (const auto& frame : frames)
+    {
+        history.append(frame.data(), ts);
+        ts += std::chrono::milliseconds{250};
+    }
+    return history;
+}
+
+static void benchFrames(BenchRunner& runner)
+{
+    constexpr size_t frameCount = 4096;
+    const auto frames = makeFrames(frameCount, 1);
+    const timestamp_t ts{};
+
+    runner.run("frame_decode", frameCount, [&](){
+        for (const auto& buf : frames)
+            doNotOptimize(Frame{buf.data(), ts});
+        return frameCount;
+    }, 14);
+
+    std::vector<History::raw_t> raw(frameCount);
+    std::vector<float> values(frameCount);
+    std::vector<float> siValues(frameCount);
+    std::vector<uint16_t> flags(frameCount);
+    runner.run("frame_decode_batch", frameCount, [&](){
+        decodeFrames(frames[0].data(), sizeof(frames[0]), frameCount, raw.data(), values.data(), siValues.data(), flags.data());
+        doNotOptimize(values.back());
+        return frameCount;
+    }, 14);
+
+    std::vector<Frame> decoded;
+    for (const auto& buf : frames)
+        decoded.emplace_back(buf.data(), ts);
+
+    runner.run("frame_get_float_val", frameCount, [&](){
+        for (const auto& frame : decoded)
+            doNotOptimize(frame.getFloatVal());
+        return frameCount;
+    });
+
+    runner.run("frame_get_unit_str", frameCount, [&](){
+        for (const auto& frame : decoded)
+            doNotOptimize(frame.getUnitStr());
+        return frameCount;
+    });
+
+    runner.run("frame_encode", frameCount, [&](){
+        for (const auto& frame : decoded)
+            doNotOptimize(Frame::encode(frame.getFloatVal(), frame.getUnit()));
+        return frameCount;
+    });
+
+    // The same frames as a byte stream with some noise between them
+    std::vector<uint8_t> stream;
+    std::mt19937 rng{3};
+    for (const auto& buf : frames)
+    {
+        if (rng() % 100 == 0)
+            stream.push_back(rng());
+        stream.insert(stream.end(), buf.begin(), buf.end());
+    }
+    DecoderStats stats;
+    FrameDecoder decoder{stats};
+    runner.run("decoder_feed", stream.size(), [&](){
+        size_t count{};
+        decoder.feed(stream.data(), stream.size(), [&](const uint8_t*){ ++count; });
+        doNotOptimize(count);
+        return stream.size();
+    }, 1);
+
+    // What the I/O thread pays for every frame with a few rules, the marks are never taken so most are dropped
+    std::vector<TriggerRule> rules;
+    for (const char* text : {"above=100V", "below=-100V", "change=50V/1s", "overload"})
+    {
+        std::string error;
+        TriggerRule::fromStr(text, rules.emplace_back(), error);
+    }
+    TriggerEngine triggers{rules, std::filesystem::temp_directory_path().string()};
+    TriggerEngine::Channel& channel = triggers.addChannel("bench");
+    runner.run("trigger_process", frameCount, [&](){
+        for (size_t i{}; i < frameCount; ++i)
+            channel.process(frames[i].data(), timestamp_t{std::chrono::milliseconds{i*10}});
+        return frameCount;
+    }, 14);
+
+    runner.run("history_append", frameCount, [&](){
+        History history;
+        for (const auto& buf : frames)
+            history.append(buf.data(), ts);
+        doNotOptimize(history.size());
+        return frameCount;
+    }, 14);
+}
+
+static void benchPlot(BenchRunner& runner)
+{
+    constexpr int width = 1920;
+    for (const size_t size : {size_t{1'000}, size_t{100'000}, size_t{1'000'000}, size_t{10'000'000}})
+    {
+        const History history = makeHistory(size);
+        PlotData data;
+
+        // The samples are a few columns apart
+        runner.run("plot_prepare_zoomed_in", size, [&](){
+            preparePlotData(history, width, PlotView{}, data);
+            return size_t{1};
+        });
+
+        // The whole history on the screen, the columns summarize many samples
+        PlotView zoomedOut;
+        while (zoomedOut.getPixelDuration()*width < history.getTimestamp(size-1)-history.getTimestamp(0)
+                && zoomedOut.zoomLevel < PlotView::maxZoomLevel)
+            zoomedOut.zoom(1);
+        runner.run("plot_prepare_envelope", size, [&](){
+            preparePlotData(history, width, zoomedOut, data);
+            return size_t{1};
+        });
+
+        runner.run("history_min_max", size, [&](){
+            doNotOptimize(history.getMinMax(size/7, size-size/9));
+            return size_t{1};
+        });
+
+        const timestamp_t first = history.getTimestamp(0);
+        const auto span = history.getTimestamp(size-1)-first;
+        size_t lookup{};
+        runner.run("history_find_time", size, [&](){
+            doNotOptimize(history.findTime(first+span/1021*(lookup++ % 1021)));
+            return size_t{1};
+        });
+    }
+}
+
+static void benchHistory(BenchRunner& runner)
+{
+    // Whole packed chunks and the last one being filled
+    constexpr size_t size = 1'000'000;
+    const History history = makeHistory(size);
+    runner.report("history_memory", size, "bytes_per_sample", double(history.getMemoryUsage())/size);
+
+    std::vector<timestamp_t> timestamps(History::chunkSize);
+    runner.run("history_sequential_read", size, [&](){
+        for (size_t begin{}; begin < size; begin += History::chunkSize)
+        {
+            const size_t end = std::min(begin+History::chunkSize, size);
+            history.getTimestamps(begin, end, timestamps.data());
+            for (size_t i=begin; i < end; ++i)
+                doNotOptimize(history.getValue(i));
+        }
+        return size;
+    });
+
+    std::vector<size_t> indices(4096);
+    std::mt19937 rng{4};
+    for (auto& index : indices)
+        index = rng() % size;
+    runner.run("history_random_read", indices.size(), [&](){
+        for (const size_t index : indices)
+        {
+            doNotOptimize(history.getTimestamp(index));
+            doNotOptimize(history.getValue(index));
+        }
+        return indices.size();
+    });
+}
+
+static void benchDiagnostics(BenchRunner& runner)
+{
+    // What every stage pays for being measured
+    constexpr size_t count = 4096;
+    runner.run("diagnostics_record", count, [&](){
+        for (size_t i{}; i < count; ++i)
+            diagnostics.recordSince(Diagnostics::Stage::Decode, Diagnostics::clock::now());
+        return count;
+    });
+
+    std::mutex mutex;
+    runner.run("diagnostics_lock", count, [&](){
+        for (size_t i{}; i < count; ++i)
+            doNotOptimize(diagnostics.lock(mutex).owns_lock());
+        return count;
+    });
+}
+
+static void benchExport(BenchRunner& runner)
+{
+    constexpr size_t size = 1'000'000;
+    const auto history = std::make_shared<const History>(makeHistory(size));
+    const std::string path = (std::filesystem::temp_directory_path()/("mx-ui-bench-"+std::to_string(getpid())+".csv")).string();
+
+    const auto exportFile{[&](){
+        CsvExporter exporter{history, path, [](){}};
+        exporter.start();
+        while (!exporter.isFinished())
+            std::this_thread::sleep_for(std::chrono::microseconds{100});
+        return size;
+    }};
+
+    exportFile();
+    const double bytesPerRow = double(std::filesystem::file_size(path))/size;
+    runner.run("csv_export", size, exportFile, bytesPerRow);
+
+    // Reads back what was exported, parsing on every core and appending on this thread
+    runner.run("csv_import", size, [&](){
+        CsvImporter importer{[](){}};
+        importer.open(path);
+        History imported;
+        CsvImporter::Batch batch;
+        while (!importer.isFinished())
+        {
+            if (importer.takeBatch(batch))
+                imported.append(batch.frames.data(), 14, batch.timestamps.data(), batch.size());
+            else
+                std::this_thread::yield();
+        }
+        doNotOptimize(imported.size());
+        return imported.size();
+    }, bytesPerRow);
+    std::filesystem::remove(path);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    for (int i=1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--filter" && i+1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--min-time" && i+1 < argc)
+            options.minTime = std::atof(argv[++i]);
+        else if (arg == "--repetitions" && i+1 < argc)
+            options.repetitions = std::max(1, std::atoi(argv[++i]));
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter SUBSTRING] [--min-time SECONDS] [--repetitions N]\n";
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    BenchRunner runner{options};
+    benchFrames(runner);
+    benchPlot(runner);
+    benchHistory(runner);
+    benchDiagnostics(runner);
+    benchExport(runner);
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "BatchDecoder.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#if defined(__x86_64__) && defined(__GNUC__)
+#   include <immintrin.h>
+#   define HAVE_SSSE3_PACK
+#endif
+
+// The value of every 7-bit segment pattern, -1 if it is not a number
+static constexpr auto segmentValues{[](){
+    std::array<int8_t, 128> table{};
+    table.fill(-1);
+    for (int digit=Frame::D0; digit <= Frame::D9; ++digit)
+        table[Frame::digitPatterns[digit]] = digit;
+    return table;
+}()};
+
+// Indexed by the three decimal point bits: DP1 << 2 | DP2 << 1 | DP3
+static constexpr float decimalDivisors[8]{1, 10, 100, 1000, 1000, 10000, 100000, 1000000};
+
+// Converts the shown digits to the base unit, indexed by the packed prefix and the decimal point bits
+static constexpr auto siScales{[](){
+    std::array<std::array<double, 8>, 8> table{};
+    for (size_t prefix{}; prefix < table.size(); ++prefix)
+    {
+        const double factor = prefix < std::size(Frame::prefixFactors) ? Frame::prefixFactors[prefix] : 1;
+        for (size_t decimals{}; decimals < 8; ++decimals)
+            table[prefix][decimals] = factor/decimalDivisors[decimals];
+    }
+    return table;
+}()};
+
+/*
+ * The packed unit of every combination of the unit segments. The index bits are:
+ *  0-2:  kilo, nano, micro   (byte 9, bits 1-3)
+ *  3-5:  mega, %, milli      (byte 10, bits 1-3)
+ *  6-7:  ohm, farad          (byte 11, bits 2-3)
+ *  8-10: Hz, V, A            (byte 12, bits 1-3)
+ * 11-12: Celsius, mV         (byte 13, bits 1-2)
+ * Where several are lit, the same one wins as in `Frame::getUnit`.
+ */
+static constexpr auto unitTable{[](){
+    using Prefix = Frame::Unit::Prefix;
+    using Base = Frame::Unit::Base;
+
+    std::array<uint16_t, 1 << 13> table{};
+    for (size_t key{}; key < table.size(); ++key)
+    {
+        const auto bit{[key](int i){ return bool(key & (1 << i)); }};
+
+        Prefix prefix = Prefix::None;
+        Base base = Base::Volt;
+        if (bit(12))
+        {
+            prefix = Prefix::Milli;
+        }
+        else
+        {
+            if (bit(0))         prefix = Prefix::Kilo;
+            else if (bit(1))    prefix = Prefix::Nano;
+            else if (bit(2))    prefix = Prefix::Micro;
+            else if (bit(3))    prefix = Prefix::Mega;
+            else if (bit(5))    prefix = Prefix::Milli;
+
+            if (bit(4))         base = Base::Percent;
+            else if (bit(6))    base = Base::Ohm;
+            else if (bit(7))    base = Base::Farad;
+            else if (bit(8))    base = Base::Hertz;
+            else if (bit(9))    base = Base::Volt;
+            else if (bit(10))   base = Base::Ampere;
+            else if (bit(11))   base = Base::Celsius;
+        }
+        table[key] = uint16_t(prefix) << History::unitPrefixShift | uint16_t(base) << History::unitBaseShift;
+    }
+    return table;
+}()};
+
+void packFrame(const uint8_t buf[14], History::raw_t& out)
+{
+    for (size_t j{}; j < History::rawSize; ++j)
+        out[j] = (buf[j*2] & 15) << 4 | (buf[j*2+1] & 15);
+}
+
+DecodedFrame decodePackedFrame(const History::raw_t& raw)
+{
+    // Byte `n` of the frame is in the high nibble of `raw[n/2]` if `n` is even, in the low one otherwise
+    DecodedFrame result;
+
+    const int d0 = segmentValues[(raw[0] & 7) << 4 | raw[1] >> 4];
+    const int d1 = segmentValues[(raw[1] & 7) << 4 | raw[2] >> 4];
+    const int d2 = segmentValues[(raw[2] & 7) << 4 | raw[3] >> 4];
+    const int d3 = segmentValues[(raw[3] & 7) << 4 | raw[4] >> 4];
+    const int unitKey = (raw[4] & 15) >> 1
+        | (raw[5] >> 5 & 7) << 3
+        | (raw[5] >> 2 & 3) << 6
+        | (raw[6] >> 5 & 7) << 8
+        | (raw[6] >> 1 & 3) << 11;
+    result.flags = unitTable[unitKey]
+        | (raw[0] >> 5 & 7)                     // Auto, DC, AC
+        | (raw[4] & 1) << 3                     // Diode
+        | (raw[5] >> 4 & 1) << 4                // Beep
+        | (raw[5] & 3) << 5                     // Hold, Rel
+        | (raw[6] >> 4 & 1) << 7;               // Battery
+
+    if ((d0 | d1 | d2 | d3) < 0)
+    {
+        result.value = NAN;
+        result.siValue = NAN;
+    }
+    else
+    {
+        const float digits = float(d0*1000 + d1*100 + d2*10 + d3);
+        const float magnitude = raw[0] & 8 ? -digits : digits;
+        const int decimalKey = (raw[1] & 8) >> 1 | (raw[2] & 8) >> 2 | (raw[3] & 8) >> 3;
+        const int prefix = result.flags >> History::unitPrefixShift & History::unitFieldMask;
+        result.value = magnitude / decimalDivisors[decimalKey];
+        result.siValue = float(magnitude * siScales[prefix][decimalKey]);
+    }
+    return result;
+}
+
+#ifdef HAVE_SSSE3_PACK
+
+__attribute__((target("ssse3")))
+static void packFramesSsse3(const uint8_t* frames, size_t stride, size_t count, History::raw_t* out)
+{
+    // Loads 16 bytes, so the last frame is packed the slow way
+    for (size_t i{}; i+1 < count; ++i)
+    {
+        const __m128i nibbles = _mm_and_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(frames+i*stride)), _mm_set1_epi8(15));
+        // Every pair of bytes becomes `even*16 + odd`
+        const __m128i pairs = _mm_maddubs_epi16(nibbles, _mm_set1_epi16(0x0110));
+        alignas(16) uint8_t bytes[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(bytes), _mm_packus_epi16(pairs, pairs));
+        std::memcpy(out[i].data(), bytes, History::rawSize);
+    }
+    if (count)
+        packFrame(frames+(count-1)*stride, out[count-1]);
+}
+
+#endif
+
+static void packFrames(const uint8_t* frames, size_t stride, size_t count, History::raw_t* out)
+{
+#ifdef HAVE_SSSE3_PACK
+    static const bool hasSsse3 = __builtin_cpu_supports("ssse3");
+    if (hasSsse3)
+        return packFramesSsse3(frames, stride, count, out);
+#endif
+    for (size_t i{}; i < count; ++i)
+        packFrame(frames+i*stride, out[i]);
+}
+
+void decodeFrames(const uint8_t* frames, size_t stride, size_t count,
+        History::raw_t* raw, float* values, float* siValues, uint16_t* flags)
+{
+    // Packed in small blocks that stay in the cache for the decoding
+    constexpr size_t blockSize = 256;
+    History::raw_t block[blockSize];
+
+    for (size_t begin{}; begin < count; begin += blockSize)
+    {
+        const size_t size = std::min(blockSize, count-begin);
+        History::raw_t* const packed = raw ? raw+begin : block;
+        packFrames(frames+begin*stride, stride, size, packed);
+
+        for (size_t i{}; i < size; ++i)
+        {
+            const DecodedFrame decoded = decodePackedFrame(packed[i]);
+            if (values)
+                values[begin+i] = decoded.value;
+            if (siValues)
+                siValues[begin+i] = decoded.siValue;
+            if (flags)
+                flags[begin+i] = decoded.flags;
+        }
+    }
+}
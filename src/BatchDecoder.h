@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "History.h"
+
+/*
+ * Table-driven decoding of raw frames straight into the columns of `History`.
+ *
+ * A frame is first packed into the 7 data bytes of `History::raw_t` (with
+ * SSSE3, when the CPU has it, this is a few vector instructions), then the value, unit and flags are looked up
+ * from precomputed tables instead of being decoded bit by bit like in `Frame`.
+ * The results are the same as `Frame::getFloatVal` and `History::packFlags`.
+ */
+
+struct DecodedFrame
+{
+    // As shown on the display
+    float value{};
+    // In the base unit, so readings in different ranges are comparable
+    float siValue{};
+    uint16_t flags{};
+};
+
+// Keeps the low nibbles of the 14 bytes, the high ones are just the byte indices
+void packFrame(const uint8_t buf[14], History::raw_t& out);
+
+DecodedFrame decodePackedFrame(const History::raw_t& raw);
+
+// Decodes `count` frames that are `stride` bytes apart in one pass, any output may be null
+void decodeFrames(const uint8_t* frames, size_t stride, size_t count,
+        History::raw_t* raw, float* values, float* siValues, uint16_t* flags);
@@ -0,0 +1,63 @@
+#include "BufferedWriter.h"
+#include <cerrno>
+
+BufferedWriter::BufferedWriter(size_t capacity)
+    : buf{std::make_unique<char[]>(capacity)}, capacity{capacity}
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    close();
+}
+
+bool BufferedWriter::open(const std::string& path)
+{
+    close();
+    error = 0;
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        error = errno;
+        return false;
+    }
+    // We do the buffering
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    return true;
+}
+
+bool BufferedWriter::close()
+{
+    if (!file)
+        return good();
+
+    flush();
+    if (std::fclose(file) != 0 && !error)
+        error = errno;
+    file = nullptr;
+    return good();
+}
+
+void BufferedWriter::flush()
+{
+    if (used && file && !error)
+    {
+        if (std::fwrite(buf.get(), 1, used, file) != used)
+            error = errno ? errno : EIO;
+    }
+    used = 0;
+}
+
+void BufferedWriter::writeLarge(const void* data, size_t size)
+{
+    flush();
+    if (size <= capacity)
+    {
+        std::copy_n(static_cast<const char*>(data), size, buf.get());
+        used = size;
+    }
+    else if (file && !error && std::fwrite(data, 1, size, file) != size)
+    {
+        error = errno ? errno : EIO;
+    }
+}
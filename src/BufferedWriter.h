@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <memory>
+
+/*
+ * Writes a file through a large buffer that is filled in place.
+ *
+ * Callers reserve room for a record, format straight into the buffer and
+ * commit the end of what they wrote, so there is no copy and no per-call
+ * locking like with iostreams or `FILE*`.
+ * Errors are sticky, `good` tells if everything written so far made it to the file.
+ */
+class BufferedWriter
+{
+public:
+    static constexpr size_t defaultCapacity = 1 << 20;
+
+    explicit BufferedWriter(size_t capacity=defaultCapacity);
+    ~BufferedWriter();
+
+    bool open(const std::string& path);
+    // Flushes and closes the file, returns `good()`
+    bool close();
+    inline bool isOpen() const { return file; }
+
+    // Returns room for at least `size` bytes (at most the capacity)
+    inline char* reserve(size_t size)
+    {
+        if (capacity-used < size)
+            flush();
+        return buf.get()+used;
+    }
+    // Marks the bytes until `end` as written
+    inline void commit(const char* end) { used = end-buf.get(); }
+
+    inline void write(const void* data, size_t size)
+    {
+        if (size > capacity-used)
+            return writeLarge(data, size);
+        std::copy_n(static_cast<const char*>(data), size, buf.get()+used);
+        used += size;
+    }
+    inline void put(char c) { *reserve(1) = c; ++used; }
+
+    void flush();
+
+    inline bool good() const { return error == 0; }
+    // The `errno` of the first failure
+    inline int getError() const { return error; }
+
+private:
+    std::unique_ptr<char[]> buf;
+    size_t capacity{};
+    size_t used{};
+    std::FILE* file{};
+    int error{};
+
+    void writeLarge(const void* data, size_t size);
+};
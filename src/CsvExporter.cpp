@@ -0,0 +1,103 @@
+#include "CsvExporter.h"
+#include "BufferedWriter.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "LocalTime.h"
+
+CsvExporter::CsvExporter(std::shared_ptr<const History> history, std::string path, NotifyFunc notify, std::string preamble)
+    : history{std::move(history)}, path{std::move(path)}, notify{std::move(notify)}, preamble{std::move(preamble)}
+{
+    rangeEnd = this->history->size();
+}
+
+CsvExporter::~CsvExporter()
+{
+    cancel();
+    if (thread.joinable())
+        thread.join();
+}
+
+void CsvExporter::setRange(size_t begin, size_t end)
+{
+    rangeEnd = std::min(end, history->size());
+    rangeBegin = std::min(begin, rangeEnd);
+}
+
+void CsvExporter::start()
+{
+    thread = std::thread{&CsvExporter::threadMain, this};
+}
+
+void CsvExporter::cancel()
+{
+    cancelRequested = true;
+}
+
+void CsvExporter::threadMain()
+{
+    // A file that couldn't be opened may still be someone's, only a partial export is removed
+    bool created{};
+    const auto finish{[this, &created](Result res){
+        if (res != Result::Done && created)
+            std::remove(path.c_str());
+        result = res;
+        notify();
+    }};
+
+    BufferedWriter writer;
+    if (!writer.open(path))
+    {
+        error = std::strerror(writer.getError());
+        return finish(Result::Failed);
+    }
+    created = true;
+
+    LocalTimeFormatter timeFormatter;
+    // Value, unit and timestamp
+    constexpr size_t maxRowSize = 32+16+LocalTimeFormatter::maxSize+1;
+
+    writer.write(preamble.data(), preamble.size());
+    static constexpr std::string_view header = "Value;Unit;Timestamp\n";
+    writer.write(header.data(), header.size());
+
+    const History& data = *history;
+    // Decoded a chunk at a time, that's much cheaper than one by one for a packed chunk
+    std::vector<timestamp_t> timestamps(History::chunkSize);
+    for (size_t begin=rangeBegin, end; begin < rangeEnd; begin = end)
+    {
+        if (cancelRequested)
+            return finish(Result::Cancelled);
+
+        end = std::min(begin - begin % History::chunkSize + History::chunkSize, rangeEnd);
+        data.getTimestamps(begin, end, timestamps.data());
+        for (size_t i=begin; i < end; ++i)
+        {
+            char* out = writer.reserve(maxRowSize);
+            // Shortest representation that reads back the same, like `std::format("{}")`
+            out = std::to_chars(out, out+32, data.getValue(i)).ptr;
+            *out++ = ';';
+            const std::string& unit = data.getUnitStr(i);
+            out = std::copy(unit.begin(), unit.end(), out);
+            *out++ = ';';
+            out = timeFormatter.format(out, timestamps[i-begin]);
+            *out++ = '\n';
+            writer.commit(out);
+        }
+
+        if (!writer.good())
+            break;
+        rowsWritten = end-rangeBegin;
+        notify();
+    }
+
+    if (!writer.close())
+    {
+        error = std::strerror(writer.getError());
+        return finish(Result::Failed);
+    }
+    finish(Result::Done);
+}
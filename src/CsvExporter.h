@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include "History.h"
+
+/*
+ * Writes a snapshot of a `History` into a CSV file on a background thread.
+ *
+ * The export can be followed through `getRowsWritten` and cancelled at any time.
+ */
+class CsvExporter
+{
+public:
+    enum class Result
+    {
+        Running,
+        Done,
+        Cancelled,
+        Failed,
+    };
+
+    // Called from the export thread whenever progress was made and when it finished
+    using NotifyFunc = std::function<void()>;
+
+    // `preamble` is written before the header, e.g. comment lines
+    CsvExporter(std::shared_ptr<const History> history, std::string path, NotifyFunc notify, std::string preamble={});
+    // Cancels the export if it is still running
+    ~CsvExporter();
+
+    // Only exports the samples in [begin, end), call before `start()`
+    void setRange(size_t begin, size_t end);
+    void start();
+    // Stops the export soon, the partially written file is removed
+    void cancel();
+
+    inline const std::string& getPath() const { return path; }
+    inline size_t getRowCount() const { return rangeEnd-rangeBegin; }
+    inline size_t getRowsWritten() const { return rowsWritten; }
+    inline Result getResult() const { return result; }
+    inline bool isFinished() const { return result != Result::Running; }
+    // Description of the failure, only valid once finished
+    inline const std::string& getError() const { return error; }
+
+private:
+    std::shared_ptr<const History> history;
+    std::string path;
+    NotifyFunc notify;
+    std::string preamble;
+    size_t rangeBegin{};
+    size_t rangeEnd{};
+    std::thread thread;
+    std::atomic<bool> cancelRequested{};
+    std::atomic<size_t> rowsWritten{};
+    std::atomic<Result> result{Result::Running};
+    std::string error;
+
+    void threadMain();
+};
@@ -0,0 +1,212 @@
+#include "CsvImporter.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Log.h"
+
+CsvImporter::CsvImporter(NotifyFunc notify, size_t threadCount)
+    : notify{std::move(notify)}, threadCount{threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency())}
+{
+}
+
+CsvImporter::~CsvImporter()
+{
+    close();
+}
+
+bool CsvImporter::open(const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_ERROR("Failed to open {}: {}", path, strerror(errno));
+        return false;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) == -1)
+    {
+        LOG_ERROR("Failed to open {}: {}", path, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    mappedSize = info.st_size;
+    void* mapping = mappedSize ? mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map {}: {}", path, strerror(errno));
+        mappedSize = 0;
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+    this->path = path;
+    if (mapping)
+        // Each piece is read from the start to the end once
+        madvise(mapping, mappedSize, MADV_SEQUENTIAL);
+
+    // Each piece ends after the first line break from its nominal end on, so no line is cut in two
+    boundaries.push_back(0);
+    while (boundaries.back() < mappedSize)
+    {
+        const size_t nominal = std::min(boundaries.back()+pieceSize, mappedSize);
+        const void* lineEnd = std::memchr(data+nominal, '\n', mappedSize-nominal);
+        boundaries.push_back(lineEnd ? static_cast<const char*>(lineEnd)-data+1 : mappedSize);
+    }
+
+    // Enough to keep every thread busy while the caller takes the pieces one by one
+    slots.resize(threadCount*2);
+    slotReady.assign(slots.size(), false);
+    for (size_t i{}; i < std::min(threadCount, getPieceCount()); ++i)
+        threads.emplace_back(&CsvImporter::threadMain, this);
+    return true;
+}
+
+void CsvImporter::close()
+{
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        stopRequested = true;
+    }
+    cond.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+
+    if (data)
+        munmap(const_cast<char*>(data), mappedSize);
+    data = nullptr;
+    mappedSize = 0;
+    path.clear();
+    boundaries.clear();
+    slots.clear();
+    slotReady.clear();
+    nextPiece = 0;
+    takenPieces = 0;
+    stopRequested = false;
+    rowCount = 0;
+    skippedLines = 0;
+}
+
+bool CsvImporter::takeBatch(Batch& out)
+{
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        if (takenPieces == getPieceCount() || !slotReady[takenPieces % slots.size()])
+            return false;
+        const size_t slot = takenPieces % slots.size();
+        out = std::move(slots[slot]);
+        slots[slot] = {};
+        slotReady[slot] = false;
+        ++takenPieces;
+    }
+    // Frees a slot for the threads
+    cond.notify_all();
+    rowCount += out.size();
+    return true;
+}
+
+bool CsvImporter::isFinished() const
+{
+    const std::lock_guard<std::mutex> guard{mutex};
+    return takenPieces == getPieceCount();
+}
+
+size_t CsvImporter::getBytesTaken() const
+{
+    const std::lock_guard<std::mutex> guard{mutex};
+    return boundaries.empty() ? 0 : boundaries[takenPieces];
+}
+
+void CsvImporter::threadMain()
+{
+    LocalTimeParser timeParser;
+    while (true)
+    {
+        size_t piece;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            // Waits for the slot of the piece to be taken
+            cond.wait(lock, [this](){
+                return stopRequested || nextPiece == getPieceCount() || nextPiece < takenPieces+slots.size();
+            });
+            if (stopRequested || nextPiece == getPieceCount())
+                return;
+            piece = nextPiece++;
+        }
+
+        Batch batch;
+        const size_t skipped = parsePiece(piece, timeParser, batch);
+        skippedLines += skipped;
+        {
+            const std::lock_guard<std::mutex> guard{mutex};
+            slots[piece % slots.size()] = std::move(batch);
+            slotReady[piece % slots.size()] = true;
+        }
+        notify();
+    }
+}
+
+size_t CsvImporter::parsePiece(size_t piece, LocalTimeParser& timeParser, Batch& out) const
+{
+    const char* in = data+boundaries[piece];
+    const char* const pieceEnd = data+boundaries[piece+1];
+    // Rows with a timestamp to the nanosecond are over 40 characters, shorter ones make the vectors grow
+    const size_t expectedRows = (pieceEnd-in)/40+1;
+    out.frames.reserve(expectedRows*14);
+    out.timestamps.reserve(expectedRows);
+
+    // The unit rarely changes from row to row
+    std::string_view lastUnitStr;
+    Frame::Unit unit{};
+    size_t skipped{};
+    while (in < pieceEnd)
+    {
+        const char* lineEnd = static_cast<const char*>(std::memchr(in, '\n', pieceEnd-in));
+        if (!lineEnd)
+            lineEnd = pieceEnd;
+        const char* const next = lineEnd+(lineEnd != pieceEnd);
+        if (lineEnd != in && lineEnd[-1] == '\r')
+            --lineEnd;
+
+        // `Value;Unit;Timestamp`, anything else is the header, a comment or broken
+        float value;
+        const auto [valueEnd, error] = std::from_chars(in, lineEnd, value);
+        const char* const unitBegin = valueEnd+1;
+        const char* const unitEnd = error == std::errc{} && valueEnd != lineEnd && *valueEnd == ';'
+            ? static_cast<const char*>(std::memchr(unitBegin, ';', lineEnd-unitBegin))
+            : nullptr;
+        if (!unitEnd)
+        {
+            // Empty lines, comments and the header are expected
+            skipped += in != lineEnd && *in != '#' && !std::string_view{in, size_t(lineEnd-in)}.starts_with("Value;");
+            in = next;
+            continue;
+        }
+
+        const std::string_view unitStr{unitBegin, size_t(unitEnd-unitBegin)};
+        timestamp_t timestamp;
+        if ((unitStr != lastUnitStr && !Frame::unitFromStr(unitStr, unit))
+         || timeParser.parse(unitEnd+1, lineEnd, timestamp) != lineEnd)
+        {
+            lastUnitStr = {};
+            ++skipped;
+            in = next;
+            continue;
+        }
+        lastUnitStr = unitStr;
+
+        // The export doesn't have the flags, so the row doesn't get any
+        const std::array<uint8_t, 14> frame = Frame::encodeReading(value, unit);
+        out.frames.insert(out.frames.end(), frame.begin(), frame.end());
+        out.timestamps.push_back(timestamp);
+        in = next;
+    }
+    return skipped;
+}
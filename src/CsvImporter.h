@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "Frame.h"
+#include "LocalTime.h"
+
+/*
+ * Reads a CSV written by `CsvExporter` back, for showing it like a journal.
+ *
+ * The file is memory-mapped and cut into line-aligned pieces, which are parsed
+ * in parallel into the raw frames of the rows. The caller takes the parsed
+ * pieces in the order of the file with `takeBatch` and appends them to a
+ * `History`. Only a few pieces are parsed ahead of the one that is taken next,
+ * so the memory used besides the history stays small for any size of file.
+ * Lines that aren't rows (comments, the header, malformed ones) are skipped.
+ */
+class CsvImporter
+{
+public:
+    // Bytes of the file per piece
+    static constexpr size_t pieceSize = 4 << 20;
+
+    struct Batch
+    {
+        // 14 bytes for each row
+        std::vector<uint8_t> frames;
+        std::vector<timestamp_t> timestamps;
+
+        inline size_t size() const { return timestamps.size(); }
+    };
+
+    // Called from the parser threads whenever a piece is done
+    using NotifyFunc = std::function<void()>;
+
+    // A `threadCount` of zero uses every core
+    explicit CsvImporter(NotifyFunc notify, size_t threadCount=0);
+    CsvImporter(const CsvImporter&) = delete;
+    CsvImporter& operator=(const CsvImporter&) = delete;
+    // Stops the parsing if it's still running
+    ~CsvImporter();
+
+    // Maps the file and starts parsing it
+    bool open(const std::string& path);
+    void close();
+
+    // Moves the next piece into `out`, false if it isn't parsed yet or there are no more
+    bool takeBatch(Batch& out);
+    // Every piece was taken
+    bool isFinished() const;
+
+    inline const std::string& getPath() const { return path; }
+    inline size_t getSize() const { return mappedSize; }
+    // Bytes of the file in the pieces taken so far
+    size_t getBytesTaken() const;
+    // In the pieces taken so far
+    inline size_t getRowCount() const { return rowCount; }
+    inline size_t getSkippedLines() const { return skippedLines; }
+
+private:
+    NotifyFunc notify;
+    size_t threadCount{};
+    std::string path;
+    const char* data{};
+    size_t mappedSize{};
+    // Piece `i` is [`boundaries[i]`, `boundaries[i+1]`)
+    std::vector<size_t> boundaries;
+
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::thread> threads;
+    // The parsed pieces that weren't taken yet, piece `i` is in slot `i` modulo their count
+    std::vector<Batch> slots;
+    std::vector<bool> slotReady;
+    size_t nextPiece{};
+    size_t takenPieces{};
+    bool stopRequested{};
+    size_t rowCount{};
+    std::atomic<size_t> skippedLines{};
+
+    inline size_t getPieceCount() const { return boundaries.empty() ? 0 : boundaries.size()-1; }
+    void threadMain();
+    // Returns the number of skipped lines
+    size_t parsePiece(size_t piece, LocalTimeParser& timeParser, Batch& out) const;
+};
@@ -0,0 +1,201 @@
+#include "DeviceMonitor.h"
+#include <cstring>
+#include <string_view>
+#include "Log.h"
+#include "simulator.h"
+#ifdef __linux__
+#   include <unistd.h>
+#   include <poll.h>
+#   include <sys/eventfd.h>
+#   include <sys/inotify.h>
+#   include <sys/socket.h>
+#   include <linux/netlink.h>
+#endif
+
+// Waits this long after an event for the rest of its burst, a plugged in device
+// makes a few, and its attributes in sysfs may not be there at the first one
+#define SETTLE_MSEC 250
+// Rescans this often when the uevents can't be received
+#define FALLBACK_RESCAN_MSEC 2000
+#define UEVENT_BUF_SIZE 8192
+
+DeviceMonitor::DeviceMonitor(NotifyFunc notify)
+    : notify{std::move(notify)}
+{
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+    stop();
+}
+
+std::vector<DeviceEvent> DeviceMonitor::takeEvents()
+{
+    const std::lock_guard<std::mutex> guard{mutex};
+    std::vector<DeviceEvent> output;
+    std::swap(output, events);
+    return output;
+}
+
+void DeviceMonitor::rescan()
+{
+    std::map<std::string, SerialDevice> current;
+    for (SerialDevice& device : listSerialDevices())
+        current.emplace(device.getKey(), std::move(device));
+
+    std::vector<DeviceEvent> changes;
+    for (const auto& [key, device] : present)
+    {
+        if (!current.contains(key))
+        {
+            LOG_INFO("Device removed: {} {} ({})", device.manufacturer, device.product, device.path);
+            changes.push_back({.type=DeviceEvent::Type::Removed, .device=device});
+        }
+    }
+    for (const auto& [key, device] : current)
+    {
+        const auto it = present.find(key);
+        if (it == present.end() || it->second.path != device.path)
+        {
+            LOG_INFO("Device added: {} {} ({})", device.manufacturer, device.product, device.path);
+            changes.push_back({.type=DeviceEvent::Type::Added, .device=device});
+        }
+    }
+    present = std::move(current);
+
+    if (changes.empty())
+        return;
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        events.insert(events.end(), std::make_move_iterator(changes.begin()), std::make_move_iterator(changes.end()));
+    }
+    notify();
+}
+
+#ifdef __linux__
+
+void DeviceMonitor::start()
+{
+    if (thread.joinable())
+        return;
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stopFd == -1)
+    {
+        LOG_ERROR("Failed to create eventfd: {}", strerror(errno));
+        return;
+    }
+    thread = std::thread{&DeviceMonitor::run, this};
+}
+
+void DeviceMonitor::stop()
+{
+    if (thread.joinable())
+    {
+        const uint64_t one = 1;
+        if (write(stopFd, &one, sizeof(one)) == -1)
+            LOG_ERROR("Failed to signal device monitor: {}", strerror(errno));
+        thread.join();
+    }
+    if (stopFd != -1)
+        close(stopFd);
+    stopFd = -1;
+}
+
+void DeviceMonitor::run()
+{
+    // The same uevents udev gets, only the ones of the tty subsystem are of interest
+    int ueventFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;
+    if (ueventFd != -1 && bind(ueventFd, (const sockaddr*)&address, sizeof(address)) == -1)
+    {
+        close(ueventFd);
+        ueventFd = -1;
+    }
+    if (ueventFd == -1)
+        LOG_WARNING("Can't receive device events ({}), looking for devices every {} ms", strerror(errno), FALLBACK_RESCAN_MSEC);
+
+    // The simulators are only links in a directory
+    std::error_code error;
+    std::filesystem::create_directories(simulatorDeviceDir(), error);
+    const int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1 || inotify_add_watch(inotifyFd, simulatorDeviceDir().c_str(),
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1)
+        LOG_WARNING("Can't watch {}: {}", simulatorDeviceDir().string(), strerror(errno));
+
+    rescan();
+
+    char buf[UEVENT_BUF_SIZE];
+    bool pending{};
+    while (true)
+    {
+        pollfd fds[]{
+            {.fd=stopFd, .events=POLLIN, .revents=0},
+            {.fd=ueventFd, .events=POLLIN, .revents=0},
+            {.fd=inotifyFd, .events=POLLIN, .revents=0},
+        };
+        const int timeout = pending ? SETTLE_MSEC : ueventFd == -1 ? FALLBACK_RESCAN_MSEC : -1;
+        const int count = poll(fds, std::size(fds), timeout);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("poll() error: {}", strerror(errno));
+            break;
+        }
+        if (fds[0].revents)
+            break;
+        if (count == 0)
+        {
+            // Quiet for a while, the burst is over
+            pending = false;
+            rescan();
+            continue;
+        }
+
+        if (fds[1].revents)
+        {
+            ssize_t size;
+            while ((size = recv(ueventFd, buf, sizeof(buf), 0)) > 0)
+            {
+                // `action@devpath`, then `KEY=value` lines, all ending with a null
+                const std::string_view message{buf, size_t(size)};
+                if (message.find(std::string_view{"\0SUBSYSTEM=tty\0", 15}) != std::string_view::npos)
+                    pending = true;
+            }
+        }
+        if (fds[2].revents)
+        {
+            while (read(inotifyFd, buf, sizeof(buf)) > 0)
+                pending = true;
+        }
+    }
+
+    if (ueventFd != -1)
+        close(ueventFd);
+    if (inotifyFd != -1)
+        close(inotifyFd);
+}
+
+#else
+
+void DeviceMonitor::start()
+{
+    if (!thread.joinable())
+        thread = std::thread{&DeviceMonitor::run, this};
+}
+
+void DeviceMonitor::stop()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+// No notifications of the devices, they're only listed once
+void DeviceMonitor::run()
+{
+    rescan();
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protocol.h"
+
+struct DeviceEvent
+{
+    enum class Type
+    {
+        Added,      // Plugged in, or moved to another port, then `device` has the new path
+        Removed,
+    } type;
+    SerialDevice device;
+};
+
+/*
+ * Watches the serial devices coming and going.
+ *
+ * A background thread lists the devices at the start, then waits for the
+ * kernel's uevents of the tty subsystem and for the links of the simulators
+ * to change. Each change is followed by a new listing (after the burst of
+ * events settles), which is compared to the previous one, so the events are
+ * the differences, keyed by `SerialDevice::getKey`.
+ * Nothing blocks the caller, the events are collected with `takeEvents` when
+ * `notify` is called.
+ */
+class DeviceMonitor
+{
+public:
+    // Called from the monitor thread when there are new events
+    using NotifyFunc = std::function<void()>;
+
+    explicit DeviceMonitor(NotifyFunc notify);
+    ~DeviceMonitor();
+
+    void start();
+    void stop();
+
+    // The events since the last call, in order
+    std::vector<DeviceEvent> takeEvents();
+
+private:
+    NotifyFunc notify;
+    std::thread thread;
+    // Signalled to stop the thread
+    int stopFd{-1};
+
+    std::mutex mutex;
+    std::vector<DeviceEvent> events;
+
+    // Only used by the thread, the devices of the last listing by their key
+    std::map<std::string, SerialDevice> present;
+
+    void run();
+    void rescan();
+};
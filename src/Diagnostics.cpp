@@ -0,0 +1,134 @@
+#include "Diagnostics.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <format>
+
+Diagnostics diagnostics;
+
+void LatencyHistogram::record(duration latency)
+{
+    const uint64_t ns = std::max<int64_t>(latency.count(), 0);
+    const size_t bucket = std::min<size_t>(std::bit_width(ns), bucketCount-1);
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+    for (int64_t current = max.load(std::memory_order_relaxed);
+            (int64_t)ns > current && !max.compare_exchange_weak(current, ns, std::memory_order_relaxed); )
+        ;
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+    uint64_t count{};
+    for (const std::atomic<uint64_t>& bucket : buckets)
+        count += bucket.load(std::memory_order_relaxed);
+    return count;
+}
+
+LatencyHistogram::duration LatencyHistogram::getMean() const
+{
+    const uint64_t n = getCount();
+    return duration{n ? int64_t(sum.load(std::memory_order_relaxed)/n) : 0};
+}
+
+LatencyHistogram::duration LatencyHistogram::getQuantile(double fraction) const
+{
+    // Other threads may record meanwhile, that's fine
+    const uint64_t rank = uint64_t(fraction*getCount());
+    uint64_t seen{};
+    for (size_t i{}; i < bucketCount; ++i)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return std::min(duration{int64_t{1} << i}, getMax());
+    }
+    return getMax();
+}
+
+Diagnostics::ScopeTimer::~ScopeTimer()
+{
+    diagnostics.recordSince(stage, start);
+}
+
+Diagnostics::Diagnostics()
+    : startTime{clock::now()}
+{
+}
+
+Diagnostics::Counters Diagnostics::getCounters() const
+{
+    return {
+        .frames = frames.load(std::memory_order_relaxed),
+        .redraws = redraws.load(std::memory_order_relaxed),
+        .renders = renders.load(std::memory_order_relaxed),
+        .lockWaits = lockWaits.load(std::memory_order_relaxed),
+        .lockWaitNs = lockWaitNs.load(std::memory_order_relaxed),
+    };
+}
+
+const char* Diagnostics::stageToStr(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::Read:       return "read";
+    case Stage::Decode:     return "decode";
+    case Stage::Trigger:    return "trigger";
+    case Stage::Queue:      return "queue";
+    case Stage::Wakeup:     return "wakeup";
+    case Stage::Ingest:     return "ingest";
+    case Stage::Update:     return "update";
+    case Stage::Render:     return "render";
+    case Stage::Draw:       return "draw";
+    case Stage::EndToEnd:   return "end_to_end";
+    case Stage::Count:      break;
+    }
+    assert(false);
+    return "";
+}
+
+std::string Diagnostics::formatTable(const Counters& previous, clock::duration elapsed) const
+{
+    const Counters current = getCounters();
+    const double seconds = std::chrono::duration<double>{elapsed}.count();
+    const auto rate{[&](uint64_t now, uint64_t before){ return seconds > 0 ? double(now-before)/seconds : 0.0; }};
+
+    std::string table = std::format("Frames/s: {:.1f}   Redraws/s: {:.1f}   Renders/s: {:.1f}\n",
+            rate(current.frames, previous.frames), rate(current.redraws, previous.redraws),
+            rate(current.renders, previous.renders));
+    table += std::format("Lock waits/s: {:.1f}, waited {:.3f} ms/s\n",
+            rate(current.lockWaits, previous.lockWaits), rate(current.lockWaitNs, previous.lockWaitNs)/1e6);
+    // In microseconds, the quantiles are rounded up to a power of two
+    table += std::format("{:<11}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n", "Stage, µs", "Count", "Mean", "50%", "90%", "99%", "Max");
+    for (size_t i{}; i < size_t(Stage::Count); ++i)
+    {
+        const LatencyHistogram& histogram = histograms[i];
+        const auto us{[](LatencyHistogram::duration d){ return std::chrono::duration<double, std::micro>{d}.count(); }};
+        table += std::format("{:<11}{:>10}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}\n",
+                stageToStr(Stage(i)), histogram.getCount(), us(histogram.getMean()),
+                us(histogram.getQuantile(0.5)), us(histogram.getQuantile(0.9)), us(histogram.getQuantile(0.99)),
+                us(histogram.getMax()));
+    }
+    return table;
+}
+
+std::string Diagnostics::formatJson() const
+{
+    const Counters counters = getCounters();
+    std::string json = std::format(R"({{"uptime_ns":{},"frames":{},"redraws":{},"renders":{},"lock_waits":{},"lock_wait_ns":{},"stages":{{)",
+            getUptime().count(), counters.frames, counters.redraws, counters.renders,
+            counters.lockWaits, counters.lockWaitNs);
+    for (size_t i{}; i < size_t(Stage::Count); ++i)
+    {
+        const LatencyHistogram& histogram = histograms[i];
+        json += std::format(R"({}"{}":{{"count":{},"mean_ns":{},"p50_ns":{},"p90_ns":{},"p99_ns":{},"max_ns":{},"buckets":[)",
+                i ? "," : "", stageToStr(Stage(i)), histogram.getCount(), histogram.getMean().count(),
+                histogram.getQuantile(0.5).count(), histogram.getQuantile(0.9).count(),
+                histogram.getQuantile(0.99).count(), histogram.getMax().count());
+        // The raw buckets, so the distributions of several dumps can be compared or merged
+        for (size_t j{}; j < LatencyHistogram::bucketCount; ++j)
+            json += std::format("{}{}", j ? "," : "", histogram.getBucket(j));
+        json += "]}";
+    }
+    json += "}}";
+    return json;
+}
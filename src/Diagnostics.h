@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+// Distribution of latencies, can be recorded to from any number of threads without locking
+class LatencyHistogram
+{
+public:
+    using duration = std::chrono::nanoseconds;
+
+    // Bucket `i` counts the latencies below 2^`i` ns (and not below 2^(`i`-1)), the last one everything above
+    static constexpr size_t bucketCount = 40;
+
+    void record(duration latency);
+
+    uint64_t getCount() const;
+    inline uint64_t getBucket(size_t i) const { return buckets[i].load(std::memory_order_relaxed); }
+    duration getMean() const;
+    inline duration getMax() const { return duration{max.load(std::memory_order_relaxed)}; }
+    // The upper bound of the bucket of the `fraction` quantile, so at most twice the real value
+    duration getQuantile(double fraction) const;
+
+private:
+    // The count is their sum, so recording touches one counter less
+    std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+    std::atomic<uint64_t> sum{};
+    std::atomic<int64_t> max{};
+};
+
+/*
+ * Always-on instrumentation of the path of a reading from the serial port to
+ * the screen.
+ *
+ * Every stage records how long it took into a histogram, the counters add up
+ * the events since the start. Recording is a few relaxed atomic operations and
+ * a read of the monotonic clock, cheap enough to leave on in every build.
+ * The rates are differences of two readings of the counters over time.
+ */
+class Diagnostics
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class Stage
+    {
+        Read,       // The read() of a serial port
+        Decode,     // Decoding what was read, including queueing the frames
+        Trigger,    // From the read to the trigger rules evaluated on a frame
+        Queue,      // From the read to the GUI thread taking the frame
+        Wakeup,     // From the I/O thread asking for an update to the GUI thread waking up
+        Ingest,     // Appending the new frames to the histories
+        Update,     // Updating the widgets
+        Render,     // Rendering the plot trace
+        Draw,       // Painting the plot
+        EndToEnd,   // From the read to the first paint that shows the frame
+        Count,
+    };
+
+    struct Counters
+    {
+        uint64_t frames{};
+        uint64_t redraws{};
+        uint64_t renders{};
+        // Times a lock was already taken and had to be waited for
+        uint64_t lockWaits{};
+        uint64_t lockWaitNs{};
+    };
+
+    // Records the time from its creation to the end of the scope into `diagnostics`
+    class ScopeTimer
+    {
+    public:
+        explicit inline ScopeTimer(Stage stage) : stage{stage}, start{clock::now()} {}
+        ScopeTimer(const ScopeTimer&) = delete;
+        ScopeTimer& operator=(const ScopeTimer&) = delete;
+        ~ScopeTimer();
+
+    private:
+        Stage stage;
+        clock::time_point start;
+    };
+
+    Diagnostics();
+
+    inline void record(Stage stage, LatencyHistogram::duration latency) { histograms[size_t(stage)].record(latency); }
+    inline void recordSince(Stage stage, const clock::time_point& start) { record(stage, clock::now()-start); }
+    inline const LatencyHistogram& getHistogram(Stage stage) const { return histograms[size_t(stage)]; }
+
+    inline void countFrames(uint64_t count) { frames.fetch_add(count, std::memory_order_relaxed); }
+    inline void countRedraw() { redraws.fetch_add(1, std::memory_order_relaxed); }
+    inline void countRender() { renders.fetch_add(1, std::memory_order_relaxed); }
+    Counters getCounters() const;
+    inline clock::duration getUptime() const { return clock::now()-startTime; }
+
+    // Locks `mutex`, the time it takes is only measured when it has to wait
+    template <typename Mutex>
+    std::unique_lock<Mutex> lock(Mutex& mutex)
+    {
+        std::unique_lock<Mutex> lock{mutex, std::try_to_lock};
+        if (!lock.owns_lock())
+        {
+            const clock::time_point start = clock::now();
+            lock.lock();
+            lockWaits.fetch_add(1, std::memory_order_relaxed);
+            lockWaitNs.fetch_add((clock::now()-start).count(), std::memory_order_relaxed);
+        }
+        return lock;
+    }
+
+    static const char* stageToStr(Stage stage);
+
+    // Human-readable, the rates are calculated from the counters `elapsed` time ago
+    std::string formatTable(const Counters& previous, clock::duration elapsed) const;
+    // One JSON object on one line
+    std::string formatJson() const;
+
+private:
+    clock::time_point startTime;
+    std::array<LatencyHistogram, size_t(Stage::Count)> histograms;
+    std::atomic<uint64_t> frames{};
+    std::atomic<uint64_t> redraws{};
+    std::atomic<uint64_t> renders{};
+    std::atomic<uint64_t> lockWaits{};
+    std::atomic<uint64_t> lockWaitNs{};
+};
+
+// Shared by the whole app
+extern Diagnostics diagnostics;
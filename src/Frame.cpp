@@ -1,10 +1,10 @@
 #include "Frame.h"
+#include <algorithm>
 #include <cmath>
-#include <bitset>
 #include <cassert>
-#include <iostream>
+#include <vector>
 
-Frame::Frame(uint8_t buf[14], const timestamp_t& ts)
+Frame::Frame(const uint8_t buf[14], const timestamp_t& ts)
 {
     timestamp       = ts;
 
@@ -128,9 +128,15 @@ Frame::Unit Frame::getUnit() const
     return result;
 }
 
-std::string Frame::getUnitStr() const
+const std::string& Frame::getUnitStr() const
 {
-    Unit unit = getUnit();
+    return unitToStr(getUnit());
+}
+
+static std::string formatUnit(Frame::Unit unit)
+{
+    using Unit = Frame::Unit;
+
     std::string result;
     switch (unit.prefix)
     {
@@ -181,27 +187,125 @@ std::string Frame::getUnitStr() const
     return result;
 }
 
+const std::string& Frame::unitToStr(Unit unit)
+{
+    // Also has room for the invalid values, their invalid part is left out
+    static const auto table{[](){
+        std::array<std::array<std::string, 8>, 8> table;
+        for (int prefix{}; prefix < 8; ++prefix)
+        {
+            for (int base{}; base < 8; ++base)
+                table[prefix][base] = formatUnit({Unit::Prefix(prefix), Unit::Base(base)});
+        }
+        return table;
+    }()};
+    return table[int(unit.prefix) & 7][int(unit.base) & 7];
+}
+
+bool Frame::unitFromStr(std::string_view str, Unit& unit)
+{
+    // Every valid unit, the strings are the interned ones of `unitToStr`
+    static const auto units{[](){
+        std::vector<std::pair<std::string_view, Unit>> units;
+        for (int prefix{}; prefix <= int(Unit::Prefix::Mega); ++prefix)
+        {
+            for (int base{}; base <= int(Unit::Base::Ampere); ++base)
+            {
+                const Unit unit{Unit::Prefix(prefix), Unit::Base(base)};
+                units.emplace_back(unitToStr(unit), unit);
+            }
+        }
+        return units;
+    }()};
+
+    const auto it = std::find_if(units.begin(), units.end(), [str](const auto& entry){ return entry.first == str; });
+    if (it == units.end())
+        return false;
+    unit = it->second;
+    return true;
+}
+
+bool Frame::isValidDigit(uint8_t digit)
+{
+    return digit == 0 || digitToVal(digit) != DEmpty;
+}
+
+// Every 7-bit pattern, the ones that aren't digits show as empty
+static constexpr auto digitTable{[](){
+    std::array<Frame::Digit, 128> table{};
+    table.fill(Frame::DEmpty);
+    for (int digit{}; digit < int(std::size(Frame::digitPatterns)); ++digit)
+        table[Frame::digitPatterns[digit]] = Frame::Digit(digit);
+    return table;
+}()};
+
 Frame::Digit Frame::digitToVal(uint8_t digit)
 {
-    switch (digit)
+    // Invalid ones are counted by `FrameDecoder`
+    return digit < digitTable.size() ? digitTable[digit] : DEmpty;
+}
+
+std::array<uint8_t, 14> Frame::encode(float value, Unit unit, bool isAuto, bool isDC)
+{
+    std::array<uint8_t, 14> buf = encodeReading(value, unit);
+    buf[0] |= isAuto << 1 | isDC << 2 | !isDC << 3;
+    return buf;
+}
+
+std::array<uint8_t, 14> Frame::encodeReading(float value, Unit unit)
+{
+    std::array<uint8_t, 14> buf{};
+    for (size_t i{}; i < buf.size(); ++i)
+        buf[i] = (i+1) << 4;
+
+    // The decimal point is before the digit of the flag
+    Digit digits[4]{DEmpty, D0, DL, DEmpty};
+    int decimals = 1;
+    const float absVal = std::fabs(value);
+    if (!std::isnan(value) && std::round(absVal) <= 9999)
+    {
+        // The same as `std::pow(10.f, decimals)` (which is a double), but much faster
+        static constexpr double powersOf10[]{1, 10, 100, 1000};
+        decimals = 3;
+        while (decimals > 0 && std::round(absVal*powersOf10[decimals]) > 9999)
+            --decimals;
+        int scaled = std::round(absVal*powersOf10[decimals]);
+        for (int i=3; i >= 0; --i)
+        {
+            digits[i] = Digit(scaled%10);
+            scaled /= 10;
+        }
+        buf[1] |= std::signbit(value) && absVal != 0 ? 1 << 3 : 0;
+    }
+    for (int i{}; i < 4; ++i)
+    {
+        const uint8_t pattern = valToDigit(digits[i]);
+        buf[1+i*2] |= pattern >> 4;
+        buf[2+i*2] |= pattern & 15;
+    }
+    if (decimals)
+        buf[1+(4-decimals)*2] |= 1 << 3;
+
+    switch (unit.prefix)
+    {
+    case Unit::Prefix::Nano:    buf[9] |= 1 << 2; break;
+    case Unit::Prefix::Micro:   buf[9] |= 1 << 3; break;
+    case Unit::Prefix::Milli:   buf[10] |= 1 << 3; break;
+    case Unit::Prefix::None:    break;
+    case Unit::Prefix::Kilo:    buf[9] |= 1 << 1; break;
+    case Unit::Prefix::Mega:    buf[10] |= 1 << 1; break;
+    }
+
+    switch (unit.base)
     {
-    case 0b01111101: return D0;
-    case 0b00000101: return D1;
-    case 0b01011011: return D2;
-    case 0b00011111: return D3;
-    case 0b00100111: return D4;
-    case 0b00111110: return D5;
-    case 0b01111110: return D6;
-    case 0b00010101: return D7;
-    case 0b01111111: return D8;
-    case 0b00111111: return D9;
-    case 0b00000000: return DEmpty;
-    case 0b01101000: return DL;
-    default:
-#ifndef NDEBUG
-        std::cerr << "Invalid digit value: " << std::bitset<8>(digit) << '\n';
-#endif
-        //assert(false);
-        return DEmpty;
+    case Unit::Base::Volt:      buf[12] |= 1 << 2; break;
+    case Unit::Base::Ohm:       buf[11] |= 1 << 2; break;
+    case Unit::Base::Farad:     buf[11] |= 1 << 3; break;
+    case Unit::Base::Hertz:     buf[12] |= 1 << 1; break;
+    case Unit::Base::Percent:   buf[10] |= 1 << 2; break;
+    case Unit::Base::Celsius:   buf[13] |= 1 << 1; break;
+    case Unit::Base::Ampere:    buf[12] |= 1 << 3; break;
     }
+
+    return buf;
 }
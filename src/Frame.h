@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <string>
+#include <string_view>
 #include <stdint.h>
 
 using timestamp_t = std::chrono::system_clock::time_point;
@@ -79,7 +82,7 @@ public:
     bool celsius{};
     bool milliVolt{};
 
-    Frame(uint8_t buf[14], const timestamp_t& ts);
+    Frame(const uint8_t buf[14], const timestamp_t& ts);
 
     inline Digit getDigitThousandVal() const { return digitToVal(digitThousand); }
     inline Digit getDigitHundredVal()  const { return digitToVal(digitHundred); }
@@ -87,13 +90,37 @@ public:
     inline Digit getDigitSingleVal()   const { return digitToVal(digitSingle); }
 
     static char digitToChar(Digit digit);
+    // False if the 7-segment pattern is not a known digit
+    static bool isValidDigit(uint8_t digit);
 
     float getFloatVal() const;
     float getFloatValOrZero() const;
 
     Unit getUnit() const;
 
-    std::string getUnitStr() const;
+    // The strings are interned, getting them never allocates
+    const std::string& getUnitStr() const;
+    static const std::string& unitToStr(Unit unit);
+    // Finds the unit `unitToStr` returns as `str`, false if there's none
+    static bool unitFromStr(std::string_view str, Unit& unit);
+
+    // Multiplying by these converts to the base unit, indexed by `Unit::Prefix`
+    static constexpr double prefixFactors[]{1e-9, 1e-6, 1e-3, 1, 1e3, 1e6};
+
+    // Builds the raw frame the meter sends when showing `value`, with as many
+    // decimals as fit on the display. NaN or a value too large shows overload.
+    static std::array<uint8_t, 14> encode(float value, Unit unit, bool isAuto=true, bool isDC=true);
+    // The same with none of the AUTO, DC and AC flags set, for readings where they aren't known
+    static std::array<uint8_t, 14> encodeReading(float value, Unit unit);
+    // The 7-segment pattern of a digit
+    static inline uint8_t valToDigit(Digit digit) { return digitPatterns[digit]; }
+
+    // The 7-segment patterns, indexed by `Digit`
+    static constexpr uint8_t digitPatterns[]{
+        0b01111101, 0b00000101, 0b01011011, 0b00011111, 0b00100111,
+        0b00111110, 0b01111110, 0b00010101, 0b01111111, 0b00111111,
+        0b00000000, 0b01101000,
+    };
 
 private:
     static Digit digitToVal(uint8_t digit);
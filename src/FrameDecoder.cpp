@@ -0,0 +1,61 @@
+#include "FrameDecoder.h"
+#include "Frame.h"
+
+FrameDecoder::FrameDecoder(DecoderStats& stats)
+    : stats{stats}
+{
+}
+
+void FrameDecoder::reset()
+{
+    drop(pos);
+}
+
+void FrameDecoder::drop(size_t count)
+{
+    if (count)
+        stats.droppedBytes.fetch_add(count, std::memory_order_relaxed);
+    pos = 0;
+}
+
+bool FrameDecoder::push(uint8_t byte)
+{
+    const size_t index = byte >> 4;
+
+    if (index == 1)
+    {
+        // A new frame cut off the previous one
+        if (pos)
+        {
+            stats.resyncs.fetch_add(1, std::memory_order_relaxed);
+            drop(pos);
+        }
+        buf[pos++] = byte;
+        return false;
+    }
+
+    if (pos == 0 || index != pos+1)
+    {
+        if (pos)
+            stats.resyncs.fetch_add(1, std::memory_order_relaxed);
+        drop(pos+1);
+        return false;
+    }
+
+    buf[pos++] = byte;
+    if (pos < frameSize)
+        return false;
+    pos = 0;
+
+    // Still passed on, the value of these is NaN
+    for (size_t i=1; i < 9; i += 2)
+    {
+        if (!Frame::isValidDigit((buf[i] & 7) << 4 | (buf[i+1] & 15)))
+        {
+            stats.badDigits.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    stats.frames.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
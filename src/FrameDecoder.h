@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+struct DecoderStats
+{
+    std::atomic<uint64_t> frames{};
+    // Bytes that weren't part of a complete frame
+    std::atomic<uint64_t> droppedBytes{};
+    // Frames that were complete, but contained an unknown digit pattern
+    std::atomic<uint64_t> badDigits{};
+    // Times a frame was cut off by the start of another one, or by an out of sequence byte
+    std::atomic<uint64_t> resyncs{};
+};
+
+/*
+ * Reassembles frames from a byte stream.
+ *
+ * The high nibble of every byte of a frame is its index starting from 1,
+ * this is used to find the frame boundaries, so reads can be of any size and
+ * may split or contain several frames. Noise is skipped until the next
+ * byte with index 1.
+ */
+class FrameDecoder
+{
+public:
+    static constexpr size_t frameSize = 14;
+
+    // The stats are only written by the decoder, they may be read from other threads
+    explicit FrameDecoder(DecoderStats& stats);
+
+    // Calls `onFrame(const uint8_t frame[14])` for every completed frame
+    template <typename F>
+    void feed(const uint8_t* data, size_t size, F&& onFrame)
+    {
+        for (size_t i{}; i < size; ++i)
+        {
+            if (push(data[i]))
+                onFrame(buf);
+        }
+    }
+
+    // Drops the partially received frame
+    void reset();
+
+private:
+    DecoderStats& stats;
+    uint8_t buf[frameSize]{};
+    size_t pos{};
+
+    // Returns true if the byte completed a frame
+    bool push(uint8_t byte);
+    void drop(size_t count);
+};
@@ -0,0 +1,204 @@
+#include "History.h"
+#include "BatchDecoder.h"
+#include "SpillFile.h"
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+
+History::History()
+{
+    static std::atomic<uint64_t> lastId{};
+    id = ++lastId;
+}
+
+void History::append(const uint8_t buf[14], const timestamp_t& ts)
+{
+    append(buf, 14, &ts, 1);
+}
+
+void History::append(const uint8_t* frames, size_t stride, const timestamp_t* timestamps, size_t count)
+{
+    while (count)
+    {
+        if (sampleCount % chunkSize == 0)
+        {
+            chunks.push_back(std::make_shared<Chunk>());
+            chunks.back()->columns = std::make_unique<Columns>();
+        }
+
+        Chunk& chunk = *chunks.back();
+        Columns& columns = *chunk.columns;
+        const size_t begin = sampleCount % chunkSize;
+        const size_t batch = std::min(count, chunkSize-begin);
+
+        decodeFrames(frames, stride, batch, &columns.raw[begin], &columns.values[begin], &columns.siValues[begin], &columns.flags[begin]);
+        std::copy(timestamps, timestamps+batch, &columns.timestamps[begin]);
+        for (size_t i=begin; i < begin+batch; ++i)
+            columns.pyramid.push(std::isnan(columns.siValues[i]) ? 0.f : columns.siValues[i]);
+
+        // Published last, the snapshots only read below `sampleCount`
+        sampleCount += batch;
+        if (sampleCount % chunkSize == 0)
+            packLastChunk();
+        frames += batch*stride;
+        timestamps += batch;
+        count -= batch;
+    }
+}
+
+void History::packLastChunk()
+{
+    const Columns& columns = *chunks.back()->columns;
+    auto packed = std::make_shared<Chunk>();
+    packed->packed = std::make_unique<PackedChunk>(columns.timestamps.data(), columns.values.data(),
+            columns.siValues.data(), columns.flags.data(), columns.raw.data(), chunkSize, columns.pyramid);
+
+    // Snapshots that were taken before keep the unpacked chunk alive as long as they need it
+    chunks.back() = std::move(packed);
+}
+
+std::shared_ptr<const History> History::snapshot() const
+{
+    return std::shared_ptr<const History>{new History{*this}};
+}
+
+float History::getValueOrZero(size_t i) const
+{
+    const float result = getValue(i);
+    return std::isnan(result) ? 0 : result;
+}
+
+float History::getSiValueOrZero(size_t i) const
+{
+    const float result = getSiValue(i);
+    return std::isnan(result) ? 0 : result;
+}
+
+void History::getTimestamps(size_t begin, size_t end, timestamp_t* out) const
+{
+    end = std::min(end, sampleCount);
+    while (begin < end)
+    {
+        const Chunk& chunk = chunkOf(begin);
+        const size_t chunkBegin = begin - begin % chunkSize;
+        const size_t chunkEnd = std::min(chunkBegin+chunkSize, end);
+        if (chunk.columns)
+            out = std::copy(&chunk.columns->timestamps[begin-chunkBegin], &chunk.columns->timestamps[chunkEnd-chunkBegin], out);
+        else
+        {
+            chunk.packed->getTimestamps(begin-chunkBegin, chunkEnd-chunkBegin, out);
+            out += chunkEnd-begin;
+        }
+        begin = chunkEnd;
+    }
+}
+
+MinMax History::getMinMax(size_t begin, size_t end) const
+{
+    MinMax result;
+    end = std::min(end, sampleCount);
+    while (begin < end)
+    {
+        const Chunk& chunk = chunkOf(begin);
+        const size_t chunkBegin = begin - begin % chunkSize;
+        const size_t chunkEnd = std::min(chunkBegin+chunkSize, end);
+        result.add(chunk.getMinMax(begin-chunkBegin, chunkEnd-chunkBegin));
+        begin = chunkEnd;
+    }
+    return result;
+}
+
+MinMax History::Chunk::getMinMax(size_t begin, size_t end) const
+{
+    if (packed)
+        return packed->getMinMax(begin, end);
+    return columns->pyramid.query(begin, end, [this](size_t i){
+        const float value = columns->siValues[i];
+        return std::isnan(value) ? 0.f : value;
+    });
+}
+
+size_t History::findTime(const timestamp_t& time) const
+{
+    // The last chunk that starts before `time`, the sample is in it or starts the next one
+    const auto it = std::lower_bound(chunks.begin(), chunks.end(), time, [](const auto& chunk, const timestamp_t& time){
+        return chunk->getTimestamp(0) < time;
+    });
+    if (it == chunks.begin())
+        return 0;
+
+    const size_t chunkBegin = (it-1-chunks.begin())*chunkSize;
+    const size_t count = std::min(chunkSize, sampleCount-chunkBegin);
+    return chunkBegin + (*(it-1))->findTime(time, count);
+}
+
+size_t History::Chunk::findTime(const timestamp_t& time, size_t count) const
+{
+    if (packed)
+        return packed->findTime(time);
+    return std::lower_bound(columns->timestamps.begin(), columns->timestamps.begin()+count, time)-columns->timestamps.begin();
+}
+
+Frame History::getFrame(size_t i) const
+{
+    const raw_t& raw = chunkOf(i).getRaw(i % chunkSize);
+    uint8_t buf[14];
+    for (size_t j{}; j < rawSize; ++j)
+    {
+        buf[j*2]   = (j*2+1) << 4 | raw[j] >> 4;
+        buf[j*2+1] = (j*2+2) << 4 | (raw[j] & 15);
+    }
+    return Frame{buf, getTimestamp(i)};
+}
+
+size_t History::getMemoryUsage() const
+{
+    size_t result = chunks.capacity()*sizeof(chunks[0]);
+    for (const auto& chunk : chunks)
+    {
+        result += sizeof(Chunk);
+        result += chunk->columns ? sizeof(Columns)+chunk->columns->pyramid.getMemoryUsage() : chunk->packed->getMemoryUsage();
+    }
+    return result;
+}
+
+size_t History::spillOldestChunk(SpillFile& file)
+{
+    if (spilledChunkCount >= chunks.size() || !chunks[spilledChunkCount]->packed)
+        return 0;
+
+    const PackedChunk& packed = *chunks[spilledChunkCount]->packed;
+    std::shared_ptr<const uint8_t> storage = file.store(packed.getData(), packed.getDataSize());
+    if (!storage)
+        return 0;
+
+    auto spilled = std::make_shared<Chunk>();
+    spilled->packed = std::make_unique<PackedChunk>(packed, std::move(storage));
+    const size_t freed = packed.getMemoryUsage()-spilled->packed->getMemoryUsage();
+    chunks[spilledChunkCount++] = std::move(spilled);
+    return freed;
+}
+
+uint16_t History::packFlags(const Frame& frame)
+{
+    const Frame::Unit unit = frame.getUnit();
+
+    return (frame.AUTO      ? FlagAuto    : 0)
+         | (frame.DC        ? FlagDC      : 0)
+         | (frame.AC        ? FlagAC      : 0)
+         | (frame.diode     ? FlagDiode   : 0)
+         | (frame.beep      ? FlagBeep    : 0)
+         | (frame.hold      ? FlagHold    : 0)
+         | (frame.rel       ? FlagRel     : 0)
+         | (frame.battery   ? FlagBattery : 0)
+         | (uint16_t)unit.prefix << unitPrefixShift
+         | (uint16_t)unit.base << unitBaseShift;
+}
+
+Frame::Unit History::unpackUnit(uint16_t flags)
+{
+    return {
+        .prefix = (Frame::Unit::Prefix)((flags >> unitPrefixShift) & unitFieldMask),
+        .base = (Frame::Unit::Base)((flags >> unitBaseShift) & unitFieldMask),
+    };
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "Frame.h"
+#include "MinMaxPyramid.h"
+#include "PackedChunk.h"
+
+class SpillFile;
+
+/*
+ * Append-only store of all the readings of a session.
+ *
+ * Samples are kept column-wise in fixed-size chunks, so appending never moves
+ * existing samples and an index always refers to the same sample.
+ * Per sample we keep the timestamp, the decoded value (both as shown and in
+ * the base unit), the packed flags/unit and the low nibbles of the raw frame (the high nibbles are just the byte
+ * sequence numbers), so the original `Frame` can always be rebuilt.
+ * Once a chunk is full it's replaced by a `PackedChunk`, which keeps the same
+ * samples in a fraction of the memory, so long captures fit in RAM. The oldest
+ * packed chunks can also be moved into a `SpillFile` to keep the memory flat.
+ *
+ * A `History` is only appended to from one thread, other threads can work on
+ * snapshots of it.
+ */
+class History
+{
+public:
+    enum Flag : uint16_t
+    {
+        FlagAuto    = 1 << 0,
+        FlagDC      = 1 << 1,
+        FlagAC      = 1 << 2,
+        FlagDiode   = 1 << 3,
+        FlagBeep    = 1 << 4,
+        FlagHold    = 1 << 5,
+        FlagRel     = 1 << 6,
+        FlagBattery = 1 << 7,
+    };
+
+    // The unit is stored in the upper bits of the flags
+    static constexpr int unitPrefixShift = 8;
+    static constexpr int unitBaseShift = 11;
+    static constexpr uint16_t unitFieldMask = 7;
+
+    static constexpr size_t chunkSize = PackedChunk::maxSize;
+    static constexpr size_t rawSize = PackedChunk::rawSize;
+
+    using raw_t = PackedChunk::raw_t;
+
+    History();
+    History(History&&) = default;
+    History& operator=(History&&) = default;
+
+    // Decodes and stores a raw 14 byte frame
+    void append(const uint8_t buf[14], const timestamp_t& ts);
+    // Decodes and stores `count` frames that are `stride` bytes apart, in one pass per chunk
+    void append(const uint8_t* frames, size_t stride, const timestamp_t* timestamps, size_t count);
+
+    // Returns a view of the samples stored until now. It shares the storage
+    // with this object, so taking it is cheap, and it can be read from any
+    // thread while new samples are appended here.
+    std::shared_ptr<const History> snapshot() const;
+
+    // Identifies the series, snapshots have the same ID as their source
+    inline uint64_t getId() const { return id; }
+
+    inline size_t size() const { return sampleCount; }
+    inline bool empty() const { return sampleCount == 0; }
+
+    inline timestamp_t getTimestamp(size_t i) const { return chunkOf(i).getTimestamp(i % chunkSize); }
+    // Cheaper than `getTimestamp()` one by one when reading many samples
+    void getTimestamps(size_t begin, size_t end, timestamp_t* out) const;
+    // As shown on the display, NaN on overload
+    inline float getValue(size_t i) const { return chunkOf(i).getValue(i % chunkSize); }
+    float getValueOrZero(size_t i) const;
+    // Converted to the base unit (V, A, Ω...), so the readings stay comparable when the range changes
+    inline float getSiValue(size_t i) const { return chunkOf(i).getSiValue(i % chunkSize); }
+    float getSiValueOrZero(size_t i) const;
+    inline uint16_t getFlags(size_t i) const { return chunkOf(i).getFlags(i % chunkSize); }
+    inline bool hasFlag(size_t i, Flag flag) const { return getFlags(i) & flag; }
+    inline Frame::Unit getUnit(size_t i) const { return unpackUnit(getFlags(i)); }
+    inline const std::string& getUnitStr(size_t i) const { return Frame::unitToStr(getUnit(i)); }
+
+    // Extrema of the SI values in [begin, end), overloaded readings count as zero
+    MinMax getMinMax(size_t begin, size_t end) const;
+
+    // The first sample at or after `time`, `size()` if there's none, in O(log n).
+    // Assumes that the timestamps don't decrease, after the clock was set back
+    // the result is somewhere around the jump.
+    size_t findTime(const timestamp_t& time) const;
+
+    // Rebuilds the frame from the stored raw bytes
+    Frame getFrame(size_t i) const;
+
+    // Bytes of RAM used for the samples, including the ones shared with snapshots
+    size_t getMemoryUsage() const;
+    // Moves the oldest packed chunk that is still in RAM into `file`.
+    // Returns the bytes of RAM freed, zero if there's nothing to move or it failed.
+    // Snapshots that were taken before keep the chunk in RAM until they're gone.
+    size_t spillOldestChunk(SpillFile& file);
+
+    static uint16_t packFlags(const Frame& frame);
+    static Frame::Unit unpackUnit(uint16_t flags);
+
+private:
+    // The chunk that is being appended to
+    struct Columns
+    {
+        std::array<timestamp_t, chunkSize> timestamps;
+        std::array<float, chunkSize> values;
+        std::array<float, chunkSize> siValues;
+        std::array<uint16_t, chunkSize> flags;
+        std::array<raw_t, chunkSize> raw;
+        MinMaxPyramid pyramid{chunkSize};
+    };
+
+    // Exactly one of `columns` and `packed` is set
+    struct Chunk
+    {
+        std::unique_ptr<Columns> columns;
+        std::unique_ptr<PackedChunk> packed;
+
+        inline timestamp_t getTimestamp(size_t i) const { return columns ? columns->timestamps[i] : packed->getTimestamp(i); }
+        inline float getValue(size_t i) const { return columns ? columns->values[i] : packed->getSymbol(i).value; }
+        inline float getSiValue(size_t i) const { return columns ? columns->siValues[i] : packed->getSymbol(i).siValue; }
+        inline uint16_t getFlags(size_t i) const { return columns ? columns->flags[i] : packed->getSymbol(i).flags; }
+        inline const raw_t& getRaw(size_t i) const { return columns ? columns->raw[i] : packed->getSymbol(i).raw; }
+        MinMax getMinMax(size_t begin, size_t end) const;
+        // The first sample at or after `time` among the first `count` ones
+        size_t findTime(const timestamp_t& time, size_t count) const;
+    };
+
+    // The chunks are shared with the snapshots, they only read the part that was filled before they were taken
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t sampleCount{};
+    // The chunks before this one are in a spill file
+    size_t spilledChunkCount{};
+    uint64_t id{};
+
+    History(const History&) = default;
+
+    inline const Chunk& chunkOf(size_t i) const { return *chunks[i / chunkSize]; }
+
+    // Replaces the last chunk, which must be full, by its packed form
+    void packLastChunk();
+};
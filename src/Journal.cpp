@@ -0,0 +1,349 @@
+#include "Journal.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Log.h"
+
+// The journal is always little-endian
+static void putU32(uint8_t* out, uint32_t value)
+{
+    for (int i{}; i < 4; ++i)
+        out[i] = value >> (i*8);
+}
+
+static void putU64(uint8_t* out, uint64_t value)
+{
+    for (int i{}; i < 8; ++i)
+        out[i] = value >> (i*8);
+}
+
+static uint32_t getU32(const uint8_t* in)
+{
+    uint32_t value{};
+    for (int i{}; i < 4; ++i)
+        value |= uint32_t(in[i]) << (i*8);
+    return value;
+}
+
+static uint64_t getU64(const uint8_t* in)
+{
+    uint64_t value{};
+    for (int i{}; i < 8; ++i)
+        value |= uint64_t(in[i]) << (i*8);
+    return value;
+}
+
+static bool writeAll(int fd, const uint8_t* data, size_t size)
+{
+    while (size)
+    {
+        const ssize_t written = write(fd, data, size);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+uint32_t journal::crc32(const uint8_t* data, size_t size)
+{
+    static const auto table{[](){
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i{}; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int j{}; j < 8; ++j)
+                crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+            table[i] = crc;
+        }
+        return table;
+    }()};
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i{}; i < size; ++i)
+        crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xff];
+    return ~crc;
+}
+
+JournalWriter::~JournalWriter()
+{
+    close();
+}
+
+bool JournalWriter::open(const std::string& path)
+{
+    close();
+    // The blocks are reused by the next journal once they're all back
+    if (blocks[0].data.empty())
+    {
+        for (Block& block : blocks)
+        {
+            block.data.resize(journal::blockHeaderSize+journal::blockCapacity*journal::recordSize);
+            freeBlocks.tryPush(&block);
+        }
+    }
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        LOG_ERROR("Failed to create journal {}: {}", path, strerror(errno));
+        return false;
+    }
+    this->path = path;
+
+    uint8_t header[journal::fileHeaderSize]{};
+    std::copy(std::begin(journal::fileMagic), std::end(journal::fileMagic), header);
+    putU32(header+8, journal::version);
+    putU32(header+12, journal::recordSize);
+    if (!writeAll(fd, header, sizeof(header)) || fdatasync(fd) == -1)
+    {
+        LOG_ERROR("Failed to write journal {}: {}", path, strerror(errno));
+        close();
+        return false;
+    }
+
+    stopRequested = false;
+    failed = false;
+    droppedRecords = 0;
+    syncRequested = false;
+    thread = std::thread{&JournalWriter::threadMain, this};
+    return true;
+}
+
+void JournalWriter::close()
+{
+    if (fd == -1)
+        return;
+    sync();
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        stopRequested = true;
+    }
+    cond.notify_one();
+    thread.join();
+    ::close(fd);
+    fd = -1;
+    if (getDroppedRecords())
+        LOG_WARNING("Dropped {} records of journal {}, the disk was too slow", getDroppedRecords(), path);
+}
+
+void JournalWriter::append(const uint8_t buf[14], const timestamp_t& ts)
+{
+    if (fd == -1 || failed.load(std::memory_order_relaxed))
+        return;
+    if (!current && !freeBlocks.tryPop(current))
+    {
+        // Every block is waiting for the disk
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint8_t* const record = current->data.data()+journal::blockHeaderSize+current->count*journal::recordSize;
+    putU64(record, std::chrono::duration_cast<std::chrono::nanoseconds>(ts.time_since_epoch()).count());
+    std::copy(buf, buf+14, record+8);
+    ++current->count;
+
+    if (current->count == journal::blockCapacity
+     || (syncRequested.load(std::memory_order_relaxed) && syncRequested.exchange(false, std::memory_order_relaxed)))
+        handOff();
+}
+
+void JournalWriter::sync()
+{
+    // A block is only taken for a record, so it's never empty
+    if (current)
+        handOff();
+}
+
+void JournalWriter::flush()
+{
+    sync();
+    std::unique_lock<std::mutex> lock{mutex};
+    writtenCond.wait(lock, [this](){ return freeBlocks.size() == blockCount || failed; });
+}
+
+void JournalWriter::handOff()
+{
+    // There's always room, the queue holds every block
+    fullBlocks.tryPush(current);
+    current = nullptr;
+    // Under the mutex, or the writer might miss it right before it waits and keep the block for a round
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        wakeRequested = true;
+    }
+    cond.notify_one();
+}
+
+void JournalWriter::threadMain()
+{
+    std::vector<Block*> written;
+    while (true)
+    {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            const bool woken = cond.wait_for(lock, syncInterval, [this](){
+                return stopRequested || std::exchange(wakeRequested, false);
+            });
+            stopping = stopRequested;
+            if (!woken)
+                syncRequested.store(true, std::memory_order_relaxed);
+        }
+
+        Block* block;
+        while (fullBlocks.tryPop(block))
+        {
+            if (!failed)
+            {
+                uint8_t* const header = block->data.data();
+                const size_t size = block->count*journal::recordSize;
+                putU32(header, journal::blockMagic);
+                putU32(header+4, block->count);
+                putU32(header+8, journal::crc32(header+journal::blockHeaderSize, size));
+                if (!writeAll(fd, header, journal::blockHeaderSize+size))
+                {
+                    LOG_ERROR("Failed to write journal {}, recording stopped: {}", path, strerror(errno));
+                    failed = true;
+                }
+            }
+            written.push_back(block);
+        }
+        if (written.empty())
+        {
+            if (stopping)
+                break;
+            continue;
+        }
+        if (!failed && fdatasync(fd) == -1)
+        {
+            LOG_ERROR("Failed to sync journal {}, recording stopped: {}", path, strerror(errno));
+            failed = true;
+        }
+
+        {
+            const std::lock_guard<std::mutex> guard{mutex};
+            for (Block* writtenBlock : written)
+            {
+                writtenBlock->count = 0;
+                freeBlocks.tryPush(writtenBlock);
+            }
+        }
+        writtenCond.notify_all();
+        written.clear();
+        if (stopping)
+            break;
+    }
+}
+
+JournalReader::~JournalReader()
+{
+    close();
+}
+
+bool JournalReader::open(const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_ERROR("Failed to open journal {}: {}", path, strerror(errno));
+        return false;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) == -1 || size_t(info.st_size) < journal::fileHeaderSize)
+    {
+        LOG_ERROR("Not a journal: {}", path);
+        ::close(fd);
+        return false;
+    }
+    mappedSize = info.st_size;
+    void* mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map journal {}: {}", path, strerror(errno));
+        mappedSize = 0;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+
+    if (!std::equal(std::begin(journal::fileMagic), std::end(journal::fileMagic), data)
+     || getU32(data+8) != journal::version || getU32(data+12) != journal::recordSize)
+    {
+        LOG_ERROR("Not a journal or unsupported version: {}", path);
+        close();
+        return false;
+    }
+    // We read it from the start to the end once
+    madvise(mapping, mappedSize, MADV_SEQUENTIAL);
+
+    size_t offset = journal::fileHeaderSize;
+    while (mappedSize-offset >= journal::blockHeaderSize)
+    {
+        const uint8_t* header = data+offset;
+        const size_t count = getU32(header+4);
+        if (getU32(header) != journal::blockMagic || count == 0 || count > journal::blockCapacity
+         || mappedSize-offset-journal::blockHeaderSize < count*journal::recordSize)
+            break;
+        blocks.push_back({.first=recordCount, .count=count, .header=header});
+        recordCount += count;
+        offset += journal::blockHeaderSize+count*journal::recordSize;
+    }
+
+    if (!blocks.empty() && !verifyBlock(blocks.size()-1))
+    {
+        offset = blocks.back().header-data;
+        recordCount -= blocks.back().count;
+        blocks.pop_back();
+    }
+    trailingGarbage = mappedSize-offset;
+    if (trailingGarbage)
+        LOG_WARNING("Journal {}: ignoring {} bytes of incomplete data at the end", path, trailingGarbage);
+    return true;
+}
+
+void JournalReader::close()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), mappedSize);
+    data = nullptr;
+    mappedSize = 0;
+    blocks.clear();
+    recordCount = 0;
+    trailingGarbage = 0;
+}
+
+bool JournalReader::verifyBlock(size_t i) const
+{
+    const Block& block = blocks[i];
+    return journal::crc32(block.header+journal::blockHeaderSize, block.count*journal::recordSize)
+        == getU32(block.header+8);
+}
+
+timestamp_t JournalReader::getTimestamp(size_t i) const
+{
+    const std::chrono::nanoseconds sinceEpoch{int64_t(getU64(recordAt(i)))};
+    return timestamp_t{std::chrono::duration_cast<timestamp_t::duration>(sinceEpoch)};
+}
+
+const uint8_t* JournalReader::recordAt(size_t i) const
+{
+    // Blocks closed by a timed sync are not full, so look the block up
+    const auto block = std::upper_bound(blocks.begin(), blocks.end(), i,
+            [](size_t i, const Block& block){ return i < block.first; })-1;
+    return block->header+journal::blockHeaderSize+(i-block->first)*journal::recordSize;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "Frame.h"
+#include "SpscRing.h"
+
+/*
+ * Binary recording of the raw frames of a device.
+ *
+ * Layout: a file header, then blocks. Every block is a block header (magic,
+ * record count, CRC-32 of the records) followed by the records, which are a
+ * 64-bit nanosecond timestamp and the 14 raw bytes each.
+ * A block is written at once and synced to disk, so after a crash the file
+ * holds every complete block and at most one torn block at the end, which the
+ * reader drops.
+ */
+namespace journal
+{
+
+static constexpr char fileMagic[8] = {'M', 'X', 'J', 'R', 'N', 'L', '\r', '\n'};
+static constexpr uint32_t version = 1;
+static constexpr uint32_t blockMagic = 0x4b4c4258; // "XBLK"
+static constexpr size_t fileHeaderSize = 16;
+static constexpr size_t blockHeaderSize = 12;
+static constexpr size_t recordSize = 8+14;
+// Records in a full block
+static constexpr size_t blockCapacity = 4096;
+
+uint32_t crc32(const uint8_t* data, size_t size);
+
+} // namespace journal
+
+/*
+ * Appends frames to a journal.
+ *
+ * Appending only copies the record into the block being filled, it never
+ * touches the disk, so it can be done on the I/O thread. The block is handed
+ * to the writer thread of the journal through a lock-free queue when it gets
+ * full, on `sync`, or with the first record after `syncInterval` passed
+ * without a block. The writer thread writes and syncs it, then gives it back.
+ * When the disk is so slow that every block is waiting for it, the records
+ * are dropped and counted instead of waiting.
+ */
+class JournalWriter
+{
+public:
+    static constexpr std::chrono::seconds syncInterval{1};
+    // Blocks being filled, waiting for the disk or free
+    static constexpr size_t blockCount = 4;
+
+    JournalWriter() = default;
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+    ~JournalWriter();
+
+    // Creates a new journal, never overwrites an existing file
+    bool open(const std::string& path);
+    // Writes out the pending records and stops the writer thread
+    void close();
+    inline bool isOpen() const { return fd != -1; }
+    inline const std::string& getPath() const { return path; }
+
+    // These are called by the one thread that records, they never wait for the disk
+    void append(const uint8_t buf[14], const timestamp_t& ts);
+    // Hands the pending records to the writer thread, which writes and syncs them right away
+    void sync();
+
+    // Like `sync`, but waits until the records are on the disk
+    void flush();
+
+    inline uint64_t getDroppedRecords() const { return droppedRecords.load(std::memory_order_relaxed); }
+
+private:
+    struct Block
+    {
+        // The block header, then room for `journal::blockCapacity` records
+        std::vector<uint8_t> data;
+        size_t count{};
+    };
+
+    int fd{-1};
+    std::string path;
+    std::array<Block, blockCount> blocks;
+    // The block being filled, only used by the recording thread
+    Block* current{};
+    // From the recording thread to the writer thread
+    SpscRing<Block*, blockCount> fullBlocks;
+    // The other way around
+    SpscRing<Block*, blockCount> freeBlocks;
+    // Set by the writer thread at the sync point, the block being filled is handed over with the next record
+    std::atomic<bool> syncRequested{};
+    std::atomic<bool> failed{};
+    std::atomic<uint64_t> droppedRecords{};
+
+    std::thread thread;
+    std::mutex mutex;
+    // Wakes the writer thread
+    std::condition_variable cond;
+    // Signalled when the writer thread gave blocks back
+    std::condition_variable writtenCond;
+    bool stopRequested{};
+    bool wakeRequested{};
+
+    void handOff();
+    void threadMain();
+};
+
+/*
+ * Reads a journal through a read-only memory mapping.
+ *
+ * Opening only walks the block headers, the records are read when they are
+ * accessed. The CRC of the last block is checked on open (a torn write is
+ * only possible there), the rest can be checked with `verifyBlock` before use.
+ */
+class JournalReader
+{
+public:
+    struct Block
+    {
+        // Index of the first record
+        size_t first{};
+        size_t count{};
+        const uint8_t* header{};
+    };
+
+    JournalReader() = default;
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+    ~JournalReader();
+
+    bool open(const std::string& path);
+    void close();
+
+    inline size_t size() const { return recordCount; }
+    inline size_t getBlockCount() const { return blocks.size(); }
+    inline const Block& getBlock(size_t i) const { return blocks[i]; }
+    bool verifyBlock(size_t i) const;
+
+    timestamp_t getTimestamp(size_t i) const;
+    inline const uint8_t* getBytes(size_t i) const { return recordAt(i)+8; }
+
+    // Bytes of the file after the last valid block
+    inline size_t getTrailingGarbage() const { return trailingGarbage; }
+
+private:
+    const uint8_t* data{};
+    size_t mappedSize{};
+    std::vector<Block> blocks;
+    size_t recordCount{};
+    size_t trailingGarbage{};
+
+    const uint8_t* recordAt(size_t i) const;
+};
@@ -0,0 +1,163 @@
+#include "LocalTime.h"
+#include <format>
+#include <stdexcept>
+
+namespace
+{
+
+// Writes `value` as exactly `width` digits
+inline char* putDigits(char* out, uint64_t value, int width)
+{
+    for (int i=width-1; i >= 0; --i)
+    {
+        out[i] = '0'+value%10;
+        value /= 10;
+    }
+    return out+width;
+}
+
+// Reads exactly `width` digits, returns false if any of them isn't one
+inline bool getDigits(const char* in, int width, int& out)
+{
+    out = 0;
+    for (int i{}; i < width; ++i)
+    {
+        const unsigned digit = unsigned(in[i])-'0';
+        if (digit > 9)
+            return false;
+        out = out*10+int(digit);
+    }
+    return true;
+}
+
+} // namespace
+
+LocalTimeFormatter::LocalTimeFormatter()
+{
+    try
+    {
+        zone = std::chrono::current_zone();
+    }
+    catch (const std::runtime_error&)
+    {
+        // Stays in UTC
+    }
+}
+
+std::chrono::seconds LocalTimeFormatter::getOffset(const timestamp_t& point)
+{
+    using namespace std::chrono;
+
+    const sys_seconds seconds = floor<std::chrono::seconds>(point);
+    if (zone && (seconds < validFrom || seconds >= validUntil))
+    {
+        const sys_info info = zone->get_info(seconds);
+        validFrom = info.begin;
+        validUntil = info.end;
+        offset = info.offset;
+    }
+    return offset;
+}
+
+char* LocalTimeFormatter::format(char* out, const timestamp_t& point)
+{
+    using namespace std::chrono;
+
+    const auto local = point.time_since_epoch() + getOffset(point);
+    const auto day = floor<days>(local);
+    const year_month_day date{sys_days{day}};
+    const hh_mm_ss<timestamp_t::duration> time{local - day};
+
+    const int year = int(date.year());
+    if (year < 0 || year > 9999)
+        return std::format_to(out, "{:%F}T{:%T}", date, time);
+
+    out = putDigits(out, year, 4);
+    *out++ = '-';
+    out = putDigits(out, unsigned(date.month()), 2);
+    *out++ = '-';
+    out = putDigits(out, unsigned(date.day()), 2);
+    *out++ = 'T';
+    out = putDigits(out, time.hours().count(), 2);
+    *out++ = ':';
+    out = putDigits(out, time.minutes().count(), 2);
+    *out++ = ':';
+    out = putDigits(out, time.seconds().count(), 2);
+    if constexpr (time.fractional_width > 0)
+    {
+        *out++ = '.';
+        out = putDigits(out, time.subseconds().count(), time.fractional_width);
+    }
+    return out;
+}
+
+LocalTimeParser::LocalTimeParser()
+{
+    try
+    {
+        zone = std::chrono::current_zone();
+    }
+    catch (const std::runtime_error&)
+    {
+        // Stays in UTC
+    }
+}
+
+const char* LocalTimeParser::parse(const char* begin, const char* end, timestamp_t& out)
+{
+    using namespace std::chrono;
+
+    // `YYYY-MM-DDTHH:MM:SS`
+    constexpr int fixedSize = 19;
+    int fields[6];
+    if (end-begin < fixedSize
+     || !getDigits(begin, 4, fields[0]) || begin[4] != '-'
+     || !getDigits(begin+5, 2, fields[1]) || begin[7] != '-'
+     || !getDigits(begin+8, 2, fields[2]) || begin[10] != 'T'
+     || !getDigits(begin+11, 2, fields[3]) || begin[13] != ':'
+     || !getDigits(begin+14, 2, fields[4]) || begin[16] != ':'
+     || !getDigits(begin+17, 2, fields[5]))
+        return nullptr;
+
+    const year_month_day date{year{fields[0]}, month{unsigned(fields[1])}, day{unsigned(fields[2])}};
+    if (!date.ok() || fields[3] > 23 || fields[4] > 59 || fields[5] > 60)
+        return nullptr;
+    const local_seconds seconds = local_days{date}+hours{fields[3]}+minutes{fields[4]}+std::chrono::seconds{fields[5]};
+
+    // The digits past the nanoseconds are dropped
+    const char* in = begin+fixedSize;
+    int64_t ns{};
+    if (in != end && *in == '.')
+    {
+        int digits{};
+        for (++in; in != end && unsigned(*in)-'0' <= 9; ++in, ++digits)
+        {
+            if (digits < 9)
+                ns = ns*10+(*in-'0');
+        }
+        if (!digits)
+            return nullptr;
+        for (; digits < 9; ++digits)
+            ns *= 10;
+    }
+
+    if (zone && (seconds < validFrom || seconds >= validUntil))
+    {
+        const local_info info = zone->get_info(seconds);
+        offset = info.first.offset;
+        // Around a change of the offset a local time may be ambiguous or not exist, those aren't cached
+        if (info.result == local_info::unique)
+        {
+            validFrom = local_seconds{info.first.begin.time_since_epoch()+info.first.offset};
+            validUntil = local_seconds{info.first.end.time_since_epoch()+info.first.offset};
+        }
+        else
+        {
+            validFrom = local_seconds::max();
+            validUntil = local_seconds::min();
+        }
+    }
+
+    out = timestamp_t{duration_cast<timestamp_t::duration>(seconds.time_since_epoch()-offset+nanoseconds{ns})};
+    return in;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include "Frame.h"
+
+/*
+ * Formats timestamps in the local time zone as `YYYY-MM-DDTHH:MM:SS.fff...`,
+ * the same way as `std::format("{0:%F}T{0:%T}", zoned_time)`.
+ *
+ * The time zone is only consulted when a timestamp falls outside the period
+ * the cached UTC offset is valid for, so it's cheap to call for every row.
+ */
+class LocalTimeFormatter
+{
+public:
+    // The longest string `format` writes
+    static constexpr size_t maxSize = 48;
+
+    LocalTimeFormatter();
+
+    // Writes the string to `out` and returns its end
+    char* format(char* out, const timestamp_t& point);
+    // What is added to UTC for the local time at `point`
+    std::chrono::seconds getOffset(const timestamp_t& point);
+
+private:
+    const std::chrono::time_zone* zone{};
+    std::chrono::sys_seconds validFrom{std::chrono::sys_seconds::max()};
+    std::chrono::sys_seconds validUntil{std::chrono::sys_seconds::min()};
+    std::chrono::seconds offset{};
+};
+
+/*
+ * Parses the timestamps `LocalTimeFormatter` writes back into points in time.
+ *
+ * Like the formatter, it caches the UTC offset and only consults the time zone
+ * when a timestamp falls outside the period it's valid for. A local time that
+ * happened twice (when the clocks were set back) is taken as the earlier one.
+ */
+class LocalTimeParser
+{
+public:
+    LocalTimeParser();
+
+    // Parses `YYYY-MM-DDTHH:MM:SS` with an optional fraction of any length at
+    // the start of [`begin`, `end`). Returns the end of the timestamp, or
+    // nullptr if there's no valid one.
+    const char* parse(const char* begin, const char* end, timestamp_t& out);
+
+private:
+    const std::chrono::time_zone* zone{};
+    std::chrono::local_seconds validFrom{std::chrono::local_seconds::max()};
+    std::chrono::local_seconds validUntil{std::chrono::local_seconds::min()};
+    std::chrono::seconds offset{};
+};
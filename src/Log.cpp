@@ -0,0 +1,215 @@
+#include "Log.h"
+#include <cctype>
+#include <cstdio>
+#include "LocalTime.h"
+
+Logger logger;
+
+namespace
+{
+
+// Marks the buffer of the thread when it exits, keeps it alive until then
+struct ThreadBufferOwner
+{
+    std::shared_ptr<std::atomic<bool>> exited;
+
+    ~ThreadBufferOwner()
+    {
+        if (exited)
+            *exited = true;
+    }
+};
+
+}
+
+Logger::~Logger()
+{
+    stop();
+}
+
+void Logger::push(Record& record)
+{
+    if (stopped.load(std::memory_order_acquire))
+    {
+        // Nothing else writes anymore, so there's nothing to wait for
+        std::string out;
+        std::vector<Record> records{record};
+        const std::lock_guard<std::mutex> guard{mutex};
+        writeRecords(records, out);
+        return;
+    }
+
+    ThreadBuffer& buffer = getThreadBuffer();
+    record.thread = buffer.thread;
+    buffer.ring.tryPush(record);
+    // The rest can wait for the next round of the writer
+    if (record.level >= LogLevel::Warning || buffer.ring.size() >= threadBufferSize/2)
+    {
+        wakeRequested.store(true, std::memory_order_relaxed);
+        cond.notify_one();
+    }
+}
+
+Logger::ThreadBuffer& Logger::getThreadBuffer()
+{
+    thread_local ThreadBuffer* buffer{};
+    thread_local ThreadBufferOwner owner;
+    if (buffer)
+        return *buffer;
+
+    auto shared = std::make_shared<ThreadBuffer>();
+    buffer = shared.get();
+    // Shares the ownership of the buffer, which outlives the thread until it's written
+    owner.exited = std::shared_ptr<std::atomic<bool>>{shared, &shared->exited};
+
+    const std::lock_guard<std::mutex> guard{mutex};
+    buffer->thread = nextThread++;
+    buffers.push_back(std::move(shared));
+    if (!writer.joinable() && !stopRequested)
+        writer = std::thread{&Logger::writerMain, this};
+    return *buffer;
+}
+
+void Logger::stop()
+{
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        stopRequested = true;
+    }
+    cond.notify_one();
+    if (writer.joinable())
+        writer.join();
+    stopped.store(true, std::memory_order_release);
+}
+
+bool Logger::flush(std::vector<Record>& records, std::string& out)
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> current;
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        current = buffers;
+    }
+
+    records.clear();
+    uint64_t drops{};
+    bool anyExited{};
+    for (const auto& buffer : current)
+    {
+        // Checked before draining, so an exited buffer is empty after it
+        anyExited |= buffer->exited.load(std::memory_order_acquire);
+        buffer->ring.drain([&](const Record& record){ records.push_back(record); });
+        const uint64_t bufferDrops = buffer->ring.getDropCount();
+        drops += bufferDrops-buffer->reportedDrops;
+        buffer->reportedDrops = bufferDrops;
+    }
+
+    if (drops)
+    {
+        Record record;
+        record.time = std::chrono::system_clock::now();
+        record.level = LogLevel::Warning;
+        record.thread = UINT32_MAX;
+        const auto result = std::format_to_n(record.text, maxMessageSize, "{} log messages were dropped, the logging is too fast", drops);
+        record.size = uint16_t(std::min<size_t>(result.size, maxMessageSize));
+        records.push_back(record);
+    }
+
+    if (anyExited)
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        std::erase_if(buffers, [](const std::shared_ptr<ThreadBuffer>& buffer){
+            return buffer->exited.load(std::memory_order_acquire) && buffer->ring.empty();
+        });
+    }
+
+    if (records.empty())
+        return false;
+    // Each ring is in order, but the threads are interleaved
+    std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b){ return a.time < b.time; });
+    writeRecords(records, out);
+    return true;
+}
+
+void Logger::writeRecords(const std::vector<Record>& records, std::string& out)
+{
+    static LocalTimeFormatter timeFormatter;
+    out.clear();
+    char time[LocalTimeFormatter::maxSize];
+    for (const Record& record : records)
+    {
+        // Only to the milliseconds, out of `YYYY-MM-DDTHH:MM:SS.fffffffff`
+        timeFormatter.format(time, record.time);
+        out.append(time, 23);
+        out += std::format(" {:<7} ", levelToStr(record.level));
+        if (record.thread != UINT32_MAX)
+            out += std::format("[{}] ", record.thread);
+        out.append(record.text, record.size);
+        out += '\n';
+    }
+    std::fwrite(out.data(), 1, out.size(), stderr);
+    std::fflush(stderr);
+}
+
+void Logger::writerMain()
+{
+    std::vector<Record> records;
+    std::string out;
+    while (true)
+    {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            // Without the mutex, a wakeup may be missed, then it's the next round
+            cond.wait_for(lock, std::chrono::milliseconds{100}, [this](){
+                return stopRequested || wakeRequested.exchange(false, std::memory_order_relaxed);
+            });
+            stopping = stopRequested;
+        }
+        // Everything that was logged before the stop is written
+        while (flush(records, out))
+            ;
+        if (stopping)
+            break;
+    }
+}
+
+const char* Logger::levelToStr(LogLevel level)
+{
+    switch (level)
+    {
+    case LogLevel::Trace:   return "trace";
+    case LogLevel::Debug:   return "debug";
+    case LogLevel::Info:    return "info";
+    case LogLevel::Warning: return "warning";
+    case LogLevel::Error:   return "error";
+    }
+    return "";
+}
+
+bool Logger::levelFromStr(const std::string& str, LogLevel& level)
+{
+    for (LogLevel candidate : {LogLevel::Trace, LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error})
+    {
+        const std::string name = levelToStr(candidate);
+        if (std::equal(str.begin(), str.end(), name.begin(), name.end(),
+                [](char a, char b){ return std::tolower((unsigned char)a) == b; }))
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LogRateLimiter::allow(uint64_t& suppressed)
+{
+    const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t allowedFrom = next.load(std::memory_order_relaxed);
+    if (now < allowedFrom || !next.compare_exchange_strong(allowedFrom, now+interval, std::memory_order_relaxed))
+    {
+        held.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = held.exchange(0, std::memory_order_relaxed);
+    return true;
+}
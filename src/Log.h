@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "SpscRing.h"
+
+enum class LogLevel
+{
+    Trace,
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+// The least severe messages that are compiled in, the ones below are removed with their arguments.
+// The number of a `LogLevel`, set by the build.
+#ifndef MX_UI_LOG_LEVEL
+#   define MX_UI_LOG_LEVEL 1
+#endif
+
+/*
+ * Leveled logger that never makes the caller wait for the output.
+ *
+ * Every thread formats its messages into a record in its own lock-free ring,
+ * a background thread collects them, sorts them by time and writes them to
+ * stderr. When a ring is full, the message is dropped and counted, the writer
+ * reports how many were lost.
+ * Use it through the `LOG_...` macros, they skip the formatting when the
+ * level is disabled.
+ */
+class Logger
+{
+public:
+    // Longer messages are cut off
+    static constexpr size_t maxMessageSize = 216;
+    // Records that can be queued per thread
+    static constexpr size_t threadBufferSize = 256;
+
+    struct Record
+    {
+        std::chrono::system_clock::time_point time;
+        LogLevel level{};
+        uint16_t size{};
+        // Number of the thread that logged it
+        uint32_t thread{};
+        char text[maxMessageSize];
+    };
+
+    Logger() = default;
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    ~Logger();
+
+    inline void setLevel(LogLevel level) { minLevel.store(level, std::memory_order_relaxed); }
+    inline bool isEnabled(LogLevel level) const { return level >= minLevel.load(std::memory_order_relaxed); }
+
+    // `suppressed` is the number of similar messages the rate limiter held back before this one
+    template <typename... Args>
+    void log(LogLevel level, uint64_t suppressed, std::format_string<Args...> format, Args&&... args)
+    {
+        Record record;
+        record.time = std::chrono::system_clock::now();
+        record.level = level;
+        const auto result = std::format_to_n(record.text, maxMessageSize, format, std::forward<Args>(args)...);
+        size_t size = std::min<size_t>(result.size, maxMessageSize);
+        if (suppressed)
+        {
+            const auto end = std::format_to_n(record.text+size, maxMessageSize-size, " ({} similar suppressed)", suppressed);
+            size = std::min<size_t>(size+end.size, maxMessageSize);
+        }
+        record.size = uint16_t(size);
+        push(record);
+    }
+
+    // Writes everything that was logged so far and stops the writer thread, later messages are written right away
+    void stop();
+
+    static const char* levelToStr(LogLevel level);
+    // Accepts the names `levelToStr` returns, in any case
+    static bool levelFromStr(const std::string& str, LogLevel& level);
+
+private:
+    struct ThreadBuffer
+    {
+        SpscRing<Record, threadBufferSize> ring;
+        uint32_t thread{};
+        // Set when the thread exited, the buffer goes away once it's written
+        std::atomic<bool> exited{};
+        // The drop count of the ring that was already reported
+        uint64_t reportedDrops{};
+    };
+
+    std::atomic<LogLevel> minLevel{LogLevel::Info};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t nextThread{};
+    std::thread writer;
+    bool stopRequested{};
+    // Asks the writer not to wait for the end of the round, the notification alone doesn't satisfy its wait
+    std::atomic<bool> wakeRequested{};
+    // Set when the writer is gone
+    std::atomic<bool> stopped{};
+
+    void push(Record& record);
+    ThreadBuffer& getThreadBuffer();
+    // Writes the queued records, returns false if there were none
+    bool flush(std::vector<Record>& records, std::string& out);
+    // Only one thread at a time, the writer or after it's gone the callers under `mutex`
+    static void writeRecords(const std::vector<Record>& records, std::string& out);
+    void writerMain();
+};
+
+// Lets a message through at most once per `interval`, any thread may ask
+class LogRateLimiter
+{
+public:
+    explicit constexpr LogRateLimiter(std::chrono::steady_clock::duration interval) : interval{interval.count()} {}
+
+    // `suppressed` is set to the number of messages held back since the last one that was let through
+    bool allow(uint64_t& suppressed);
+
+private:
+    int64_t interval;
+    std::atomic<int64_t> next{};
+    std::atomic<uint64_t> held{};
+};
+
+// Shared by the whole app
+extern Logger logger;
+
+#define MX_LOG(level, ...) \
+    do { \
+        if constexpr (int(LogLevel::level) >= MX_UI_LOG_LEVEL) \
+        { \
+            if (logger.isEnabled(LogLevel::level)) \
+                logger.log(LogLevel::level, 0, __VA_ARGS__); \
+        } \
+    } while (false)
+
+#define LOG_TRACE(...) MX_LOG(Trace, __VA_ARGS__)
+#define LOG_DEBUG(...) MX_LOG(Debug, __VA_ARGS__)
+#define LOG_INFO(...) MX_LOG(Info, __VA_ARGS__)
+#define LOG_WARNING(...) MX_LOG(Warning, __VA_ARGS__)
+#define LOG_ERROR(...) MX_LOG(Error, __VA_ARGS__)
+
+// At most one message per `interval` from this line, for the ones that could repeat quickly
+#define LOG_LIMITED(level, interval, ...) \
+    do { \
+        if constexpr (int(LogLevel::level) >= MX_UI_LOG_LEVEL) \
+        { \
+            static LogRateLimiter limiter{interval}; \
+            uint64_t suppressed{}; \
+            if (logger.isEnabled(LogLevel::level) && limiter.allow(suppressed)) \
+                logger.log(LogLevel::level, suppressed, __VA_ARGS__); \
+        } \
+    } while (false)
@@ -0,0 +1,59 @@
+#include "MemoryBudget.h"
+#include <algorithm>
+#include <filesystem>
+#include "Log.h"
+
+MemoryBudget::MemoryBudget(size_t limit, std::string spillDir)
+    : limit{limit}, spillDir{std::move(spillDir)}
+{
+}
+
+size_t MemoryBudget::enforce(std::vector<History>& histories)
+{
+    std::vector<size_t> spillable(histories.size());
+    size_t total{};
+    for (size_t i{}; i < histories.size(); ++i)
+    {
+        spillable[i] = histories[i].getMemoryUsage();
+        total += spillable[i];
+    }
+    if (!limit || total <= limit || failed)
+        return total;
+
+    if (!file.isOpen())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(spillDir, error);
+        if (!file.open(spillDir))
+        {
+            failed = true;
+            return total;
+        }
+        LOG_INFO("Memory budget of {} MiB reached, moving old samples to {}", limit/(1024*1024), spillDir);
+    }
+
+    while (total > limit)
+    {
+        // Every device keeps as much of its recent past in RAM as it can
+        const auto largest = std::max_element(spillable.begin(), spillable.end());
+        if (*largest == 0)
+            break;
+
+        const size_t freed = histories[largest-spillable.begin()].spillOldestChunk(file);
+        if (!file.isOpen())
+        {
+            failed = true;
+            break;
+        }
+        // Nothing more to take from this one
+        *largest = freed ? *largest-std::min(*largest, freed) : 0;
+        total -= std::min(total, freed);
+    }
+
+    if (total > limit && !warnedOverBudget)
+    {
+        LOG_WARNING("The samples don't fit in the memory budget of {} MiB", limit/(1024*1024));
+        warnedOverBudget = true;
+    }
+    return total;
+}
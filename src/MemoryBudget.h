@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "History.h"
+#include "SpillFile.h"
+
+/*
+ * Keeps the samples of all the histories within a fixed amount of RAM.
+ *
+ * The newest samples of a history are hot in its unpacked chunk, the full
+ * chunks are packed, and when the packed ones don't fit any more, the oldest
+ * ones of the history that uses the most are moved into a spill file. They're
+ * paged back in from there when the plot or an export reads them, so the
+ * memory stays flat no matter how long the app runs.
+ */
+class MemoryBudget
+{
+public:
+    // A `limit` of zero keeps everything in RAM
+    MemoryBudget(size_t limit, std::string spillDir);
+
+    // Spills chunks until the histories fit, returns the RAM they use afterwards
+    size_t enforce(std::vector<History>& histories);
+
+    inline size_t getLimit() const { return limit; }
+    // Bytes moved to the disk
+    inline uint64_t getSpilledSize() const { return file.getSize(); }
+
+private:
+    size_t limit{};
+    std::string spillDir;
+    SpillFile file;
+    // Spilling is given up after an error, so it isn't retried (and logged) on every update
+    bool failed{};
+    bool warnedOverBudget{};
+};
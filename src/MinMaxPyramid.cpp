@@ -0,0 +1,37 @@
+#include "MinMaxPyramid.h"
+#include <cassert>
+
+MinMaxPyramid::MinMaxPyramid(size_t capacity)
+    : capacity{capacity}
+{
+    assert(capacity >= blockSize && (capacity & (capacity-1)) == 0);
+
+    size_t offset{};
+    for (size_t levelSize=capacity/blockSize; levelSize; levelSize /= 2)
+    {
+        levelOffsets.push_back(offset);
+        offset += levelSize;
+    }
+    entries.resize(offset);
+}
+
+void MinMaxPyramid::push(float val)
+{
+    pending.add(val);
+    ++count;
+    if (count % blockSize)
+        return;
+
+    // A block got completed, propagate it up while it completes a pair
+    MinMax block = pending;
+    pending = {};
+    size_t index = count/blockSize-1;
+    for (size_t level{}; level < levelOffsets.size(); ++level)
+    {
+        entries[levelOffsets[level]+index] = block;
+        if (index % 2 == 0)
+            break;
+        block.add(entries[levelOffsets[level]+index-1]);
+        index /= 2;
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+
+struct MinMax
+{
+    float min{std::numeric_limits<float>::infinity()};
+    float max{-std::numeric_limits<float>::infinity()};
+
+    inline bool empty() const { return min > max; }
+
+    inline void add(float val)
+    {
+        min = std::min(min, val);
+        max = std::max(max, val);
+    }
+
+    inline void add(const MinMax& other)
+    {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+/*
+ * Multi-resolution min/max summary of an append-only series.
+ *
+ * Level 0 holds the extrema of every complete block of `blockSize` samples,
+ * each next level merges two blocks of the previous one.
+ * A range query touches at most two blocks per level and scans at most
+ * 2*`blockSize` samples, so it costs O(log n) no matter how long the range is.
+ *
+ * The storage is allocated up front and a block is never written again once
+ * it's complete, so ranges that were already pushed can be queried from
+ * another thread while new values are being pushed.
+ */
+class MinMaxPyramid
+{
+public:
+    static constexpr size_t blockSize = 16;
+
+    // `capacity` must be a power of two and at least `blockSize`
+    explicit MinMaxPyramid(size_t capacity);
+
+    void push(float val);
+
+    // `leaf(i)` must return the i-th pushed value, `end` must not be past the pushed values
+    template <typename Leaf>
+    inline MinMax query(size_t begin, size_t end, Leaf&& leaf) const
+    {
+        return queryEntries(entries.data(), capacity, begin, end, std::forward<Leaf>(leaf));
+    }
+
+    // All the levels after each other. Once the pyramid is full, a copy of
+    // them can be queried with `queryEntries()` instead of keeping the pyramid.
+    inline const std::vector<MinMax>& getEntries() const { return entries; }
+
+    template <typename Leaf>
+    static MinMax queryEntries(const MinMax* entries, size_t capacity, size_t begin, size_t end, Leaf&& leaf)
+    {
+        MinMax result;
+        if (begin >= end)
+            return result;
+
+        // Scan the unaligned edges
+        while (begin < end && begin % blockSize)
+            result.add(leaf(begin++));
+        while (end > begin && end % blockSize)
+            result.add(leaf(--end));
+
+        size_t lo = begin/blockSize;
+        size_t hi = end/blockSize;
+        const MinMax* blocks = entries;
+        for (size_t levelSize=capacity/blockSize; lo < hi; levelSize /= 2)
+        {
+            if (lo & 1)
+                result.add(blocks[lo++]);
+            if (hi & 1)
+                result.add(blocks[--hi]);
+            lo /= 2;
+            hi /= 2;
+            blocks += levelSize;
+        }
+        return result;
+    }
+
+    inline size_t getMemoryUsage() const { return entries.capacity()*sizeof(MinMax) + levelOffsets.capacity()*sizeof(size_t); }
+
+private:
+    std::vector<MinMax> entries;
+    std::vector<size_t> levelOffsets;
+    size_t capacity{};
+    MinMax pending;
+    size_t count{};
+};
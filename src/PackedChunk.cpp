@@ -0,0 +1,236 @@
+#include "PackedChunk.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+// Small steps of either sign get short codes
+inline uint64_t zigzag(int64_t val) { return (uint64_t)val << 1 ^ (uint64_t)(val >> 63); }
+inline int64_t unzigzag(uint64_t val) { return (int64_t)(val >> 1) ^ -(int64_t)(val & 1); }
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t val)
+{
+    for (; val >= 0x80; val >>= 7)
+        out.push_back((uint8_t)val | 0x80);
+    out.push_back((uint8_t)val);
+}
+
+inline uint64_t getVarint(const uint8_t*& in)
+{
+    uint64_t result{};
+    for (int shift{};; shift += 7)
+    {
+        const uint8_t byte = *in++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return result;
+    }
+}
+
+// The steps are computed modulo 2^64, so even a jumping clock round-trips
+inline int64_t stepBetween(const timestamp_t::duration& from, const timestamp_t::duration& to)
+{
+    return (int64_t)((uint64_t)to.count() - (uint64_t)from.count());
+}
+
+inline timestamp_t::duration addStep(const timestamp_t::duration& d, int64_t step)
+{
+    return timestamp_t::duration{(int64_t)((uint64_t)d.count() + (uint64_t)step)};
+}
+
+}
+
+PackedChunk::PackedChunk(const timestamp_t* timestamps, const float* values, const float* siValues,
+        const uint16_t* flags, const raw_t* raw, size_t count, const MinMaxPyramid& pyramid)
+    : count{count}
+{
+    assert(count > 0 && count <= maxSize);
+
+    // The raw frame determines everything else, so it's the key of the dictionary
+    std::vector<Symbol> symbolList;
+    std::vector<Run> runList;
+    std::unordered_map<uint64_t, uint16_t> symbolIds;
+    for (size_t i{}; i < count; ++i)
+    {
+        if (i && raw[i] == raw[i-1])
+            continue;
+
+        uint64_t key{};
+        std::memcpy(&key, raw[i].data(), rawSize);
+        const auto [it, inserted] = symbolIds.try_emplace(key, (uint16_t)symbolList.size());
+        if (inserted)
+            symbolList.push_back({values[i], siValues[i], flags[i], raw[i]});
+        runList.push_back({(uint16_t)i, it->second});
+    }
+
+    std::vector<Checkpoint> checkpointList;
+    std::vector<uint8_t> stepList;
+    timestamp_t::duration interval{};
+    uint32_t run{};
+    for (size_t i{}; i < count; ++i)
+    {
+        if (i)
+        {
+            const timestamp_t::duration next = timestamps[i]-timestamps[i-1];
+            putVarint(stepList, zigzag(stepBetween(interval, next)));
+            interval = next;
+        }
+        while (run+1 < runList.size() && runList[run+1].start <= i)
+            ++run;
+        if (i % checkpointInterval == 0)
+            checkpointList.push_back({timestamps[i], interval, (uint32_t)stepList.size(), run});
+    }
+
+    assert(pyramid.getEntries().size() == 2*maxSize/MinMaxPyramid::blockSize-1);
+    pyramidSize = pyramid.getEntries().size();
+    symbolCount = symbolList.size();
+    runCount = runList.size();
+    timeStepsSize = stepList.size();
+    dataSize = getLayout().size;
+
+    uint8_t* const data = new uint8_t[dataSize];
+    storage.reset(data, std::default_delete<uint8_t[]>());
+    layOut();
+    std::copy(checkpointList.begin(), checkpointList.end(), const_cast<Checkpoint*>(checkpoints));
+    std::copy(pyramid.getEntries().begin(), pyramid.getEntries().end(), const_cast<MinMax*>(this->pyramid));
+    std::copy(symbolList.begin(), symbolList.end(), const_cast<Symbol*>(symbols));
+    std::copy(runList.begin(), runList.end(), const_cast<Run*>(runs));
+    std::copy(stepList.begin(), stepList.end(), const_cast<uint8_t*>(timeSteps));
+}
+
+PackedChunk::PackedChunk(const PackedChunk& other, std::shared_ptr<const uint8_t> storage)
+    : storage{std::move(storage)}, dataSize{other.dataSize}, external{true}, count{other.count},
+      pyramidSize{other.pyramidSize}, symbolCount{other.symbolCount}, runCount{other.runCount},
+      timeStepsSize{other.timeStepsSize}
+{
+    layOut();
+}
+
+PackedChunk::Layout PackedChunk::getLayout() const
+{
+    // From the strictest alignment to the loosest, so nothing needs padding
+    Layout layout;
+    size_t offset{};
+    const auto place{[&]<typename T>(size_t& arrayOffset, const T*, size_t size){
+        arrayOffset = offset;
+        offset += size*sizeof(T);
+    }};
+    place(layout.checkpoints, checkpoints, (count+checkpointInterval-1)/checkpointInterval);
+    place(layout.pyramid, pyramid, pyramidSize);
+    place(layout.symbols, symbols, symbolCount);
+    place(layout.runs, runs, runCount);
+    place(layout.timeSteps, timeSteps, timeStepsSize);
+    layout.size = offset;
+    return layout;
+}
+
+void PackedChunk::layOut()
+{
+    const Layout layout = getLayout();
+    const uint8_t* const base = storage.get();
+    checkpoints = reinterpret_cast<const Checkpoint*>(base+layout.checkpoints);
+    pyramid = reinterpret_cast<const MinMax*>(base+layout.pyramid);
+    symbols = reinterpret_cast<const Symbol*>(base+layout.symbols);
+    runs = reinterpret_cast<const Run*>(base+layout.runs);
+    timeSteps = base+layout.timeSteps;
+}
+
+const PackedChunk::Run& PackedChunk::findRun(size_t i) const
+{
+    // The last run that starts at or before `i`, it's between the runs of the surrounding checkpoints
+    const size_t checkpoint = i / checkpointInterval;
+    const Run* const first = runs+checkpoints[checkpoint].run;
+    const Run* const last = (checkpoint+1)*checkpointInterval < count ? runs+checkpoints[checkpoint+1].run+1 : runs+runCount;
+    const Run* const it = std::upper_bound(first, last, i, [](size_t index, const Run& run){
+        return index < run.start;
+    });
+    return *(it-1);
+}
+
+timestamp_t PackedChunk::getTimestamp(size_t i) const
+{
+    timestamp_t result;
+    getTimestamps(i, i+1, &result);
+    return result;
+}
+
+void PackedChunk::getTimestamps(size_t begin, size_t end, timestamp_t* out) const
+{
+    end = std::min(end, count);
+    if (begin >= end)
+        return;
+
+    const Checkpoint& checkpoint = checkpoints[begin / checkpointInterval];
+    timestamp_t timestamp = checkpoint.timestamp;
+    timestamp_t::duration interval = checkpoint.interval;
+    const uint8_t* in = timeSteps+checkpoint.offset;
+    for (size_t i = begin - begin % checkpointInterval;; )
+    {
+        if (i >= begin)
+            *out++ = timestamp;
+        if (++i == end)
+            break;
+        interval = addStep(interval, unzigzag(getVarint(in)));
+        timestamp += interval;
+    }
+}
+
+MinMax PackedChunk::getMinMax(size_t begin, size_t end) const
+{
+    end = std::min(end, count);
+    if (begin >= end)
+        return {};
+
+    // The unaligned edges are scanned a run at a time rather than a sample at a time,
+    // so the pyramid is only asked about whole blocks
+    constexpr size_t blockSize = MinMaxPyramid::blockSize;
+    const size_t alignedBegin = std::min((begin+blockSize-1) / blockSize * blockSize, end);
+    const size_t alignedEnd = std::max(end / blockSize * blockSize, alignedBegin);
+    MinMax result;
+    const auto scanRuns{[&](size_t from, size_t to){
+        if (from >= to)
+            return;
+        for (const Run* run = &findRun(from); run < runs+runCount && run->start < to; ++run)
+        {
+            const float value = symbols[run->symbol].siValue;
+            result.add(std::isnan(value) ? 0.f : value);
+        }
+    }};
+    scanRuns(begin, alignedBegin);
+    scanRuns(alignedEnd, end);
+    result.add(MinMaxPyramid::queryEntries(pyramid, maxSize, alignedBegin, alignedEnd, [](size_t){ return 0.f; }));
+    return result;
+}
+
+size_t PackedChunk::findTime(const timestamp_t& time) const
+{
+    // The last checkpoint before `time`, then step forward from it
+    const size_t checkpointCount = (count+checkpointInterval-1)/checkpointInterval;
+    const Checkpoint* const it = std::lower_bound(checkpoints, checkpoints+checkpointCount, time,
+            [](const Checkpoint& checkpoint, const timestamp_t& time){ return checkpoint.timestamp < time; });
+    if (it == checkpoints)
+        return 0;
+
+    const Checkpoint& checkpoint = *(it-1);
+    size_t i = (it-1-checkpoints)*checkpointInterval;
+    const size_t end = std::min(i+checkpointInterval, count);
+    timestamp_t timestamp = checkpoint.timestamp;
+    timestamp_t::duration interval = checkpoint.interval;
+    const uint8_t* in = timeSteps+checkpoint.offset;
+    while (timestamp < time && ++i < end)
+    {
+        interval = addStep(interval, unzigzag(getVarint(in)));
+        timestamp += interval;
+    }
+    return i;
+}
+
+size_t PackedChunk::getMemoryUsage() const
+{
+    return sizeof(*this) + (external ? 0 : dataSize);
+}
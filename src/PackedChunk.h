@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include "Frame.h"
+#include "MinMaxPyramid.h"
+
+/*
+ * Compressed, read-only copy of a full chunk of a `History`.
+ *
+ * Meter readings are very repetitive: the same frame often comes many times
+ * in a row and the flags/unit almost never change. So every distinct frame of
+ * the chunk is stored once in a dictionary, together with its decoded value
+ * and flags, and the samples only as runs of the same dictionary entry.
+ * The timestamps are varint coded differences of the intervals, they're close
+ * to zero for a meter that sends at a steady rate.
+ *
+ * Every `checkpointInterval` samples a checkpoint tells where to continue,
+ * a sample is found by a binary search over the runs between two checkpoints
+ * and a timestamp is decoded from the closest preceding one, so random access
+ * stays cheap without unpacking the chunk.
+ *
+ * Everything, including the min/max pyramid of the chunk, is in one block of
+ * memory, which can be moved elsewhere (e.g. into a mapped file) as it is.
+ */
+class PackedChunk
+{
+public:
+    static constexpr size_t rawSize = 7;
+    static constexpr size_t maxSize = 1 << 16;
+    // A timestamp is decoded from at most this many steps
+    static constexpr size_t checkpointInterval = 128;
+
+    using raw_t = std::array<uint8_t, rawSize>;
+
+    struct Symbol
+    {
+        float value;
+        float siValue;
+        uint16_t flags;
+        raw_t raw;
+    };
+
+    // `count` must be between 1 and `maxSize`, `pyramid` must have a capacity of `maxSize`
+    PackedChunk(const timestamp_t* timestamps, const float* values, const float* siValues,
+            const uint16_t* flags, const raw_t* raw, size_t count, const MinMaxPyramid& pyramid);
+    // The same chunk, reading from `storage`, which must hold a copy of `other.getData()`
+    PackedChunk(const PackedChunk& other, std::shared_ptr<const uint8_t> storage);
+
+    inline size_t size() const { return count; }
+
+    inline const Symbol& getSymbol(size_t i) const { return symbols[findRun(i).symbol]; }
+    timestamp_t getTimestamp(size_t i) const;
+    // Decodes the timestamps in [begin, end) in one pass
+    void getTimestamps(size_t begin, size_t end, timestamp_t* out) const;
+    // Extrema of the SI values in [begin, end), overloaded readings count as zero
+    MinMax getMinMax(size_t begin, size_t end) const;
+    // The first sample at or after `time`, `size()` if there's none
+    size_t findTime(const timestamp_t& time) const;
+
+    // The block that holds the whole chunk
+    inline const uint8_t* getData() const { return storage.get(); }
+    inline size_t getDataSize() const { return dataSize; }
+    // Bytes of RAM used by this chunk, a block that was moved elsewhere doesn't count
+    size_t getMemoryUsage() const;
+
+private:
+    // The samples from `start` until the start of the next run are all `symbols[symbol]`
+    struct Run
+    {
+        uint16_t start;
+        uint16_t symbol;
+    };
+
+    struct Checkpoint
+    {
+        timestamp_t timestamp;
+        // The interval that ended at `timestamp`
+        timestamp_t::duration interval;
+        // Where the next sample starts in `timeSteps`
+        uint32_t offset;
+        // The run that contains the sample, narrows down the search
+        uint32_t run;
+    };
+
+    std::shared_ptr<const uint8_t> storage;
+    size_t dataSize{};
+    bool external{};
+    size_t count{};
+    size_t pyramidSize{};
+    size_t symbolCount{};
+    size_t runCount{};
+    size_t timeStepsSize{};
+
+    // Point into `storage`, in this order
+    const Checkpoint* checkpoints{};
+    const MinMax* pyramid{};
+    const Symbol* symbols{};
+    const Run* runs{};
+    const uint8_t* timeSteps{};
+
+    // Offsets of the arrays in `storage`
+    struct Layout
+    {
+        size_t checkpoints{};
+        size_t pyramid{};
+        size_t symbols{};
+        size_t runs{};
+        size_t timeSteps{};
+        // Of the whole block
+        size_t size{};
+    };
+
+    const Run& findRun(size_t i) const;
+    // Only from the sizes, so it works before there's a block
+    Layout getLayout() const;
+    // Points the arrays into `storage`
+    void layOut();
+};
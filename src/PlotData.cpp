@@ -0,0 +1,156 @@
+#include "PlotData.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include "LocalTime.h"
+
+namespace
+{
+
+// Rounds towards negative infinity, unlike `/`
+inline int64_t floorDiv(int64_t a, int64_t b)
+{
+    return a/b - (a%b < 0);
+}
+
+}
+
+void PlotView::zoom(int steps)
+{
+    zoomLevel = std::clamp(zoomLevel+steps, 0, maxZoomLevel);
+}
+
+void PlotView::pan(const History& history, int pixels)
+{
+    if (history.empty())
+        return;
+
+    // The oldest sample stays on the screen
+    const int64_t lastBucket = std::max(getLastBucket(history)-pixels, getBucket(history.getTimestamp(0)));
+    if (lastBucket >= getBucket(history.getTimestamp(history.size()-1)))
+        end.reset();
+    else
+        // The last moment of the bucket, so it's the one at the edge
+        end = getBucketStart(lastBucket+1)-duration{1};
+}
+
+int64_t PlotView::getBucket(const timestamp_t& time) const
+{
+    return floorDiv(time.time_since_epoch().count(), getPixelDuration().count());
+}
+
+timestamp_t PlotView::getBucketStart(int64_t bucket) const
+{
+    return timestamp_t{bucket*getPixelDuration()};
+}
+
+int64_t PlotView::getLastBucket(const History& history) const
+{
+    if (end)
+        return getBucket(*end);
+    return history.empty() ? 0 : getBucket(history.getTimestamp(history.size()-1));
+}
+
+int PlotView::bucketToX(int64_t bucket, int64_t lastBucket, int width)
+{
+    // Far enough to be off the screen, but still fits the coordinates of Cairo
+    constexpr int64_t limit = 1 << 22;
+    return width-(int)std::clamp(lastBucket-bucket, -limit, limit);
+}
+
+void preparePlotData(const History& history, int width, const PlotView& view, PlotData& out, int64_t firstBucket)
+{
+    out.columns.clear();
+    out.maxAbs = 0;
+    out.lastBucket = 0;
+    if (history.empty() || width <= 0)
+        return;
+
+    const int64_t lastBucket = view.getLastBucket(history);
+    const int64_t firstVisible = lastBucket-width+1;
+    const size_t visibleBegin = history.findTime(view.getBucketStart(firstVisible));
+    const size_t visibleEnd = history.findTime(view.getBucketStart(lastBucket+1));
+
+    const MinMax visibleRange = history.getMinMax(visibleBegin, visibleEnd);
+    out.maxAbs = visibleRange.empty() ? 0 : std::max(std::abs(visibleRange.min), std::abs(visibleRange.max));
+    out.lastBucket = lastBucket;
+
+    const int64_t maxGapBuckets = std::max<int64_t>(1, PlotView::maxConnectedGap/view.getPixelDuration());
+    size_t i = history.findTime(view.getBucketStart(std::max(firstBucket, firstVisible)));
+    if (i)
+        --i;
+    // A column at a time, each is found with a binary search, so it costs the same at any zoom
+    while (i < visibleEnd)
+    {
+        const int64_t bucket = view.getBucket(history.getTimestamp(i));
+        // At least one sample, even if the clock went backwards
+        const size_t next = std::clamp(history.findTime(view.getBucketStart(bucket+1)), i+1, visibleEnd);
+
+        PlotColumn column;
+        column.bucket = bucket;
+        column.x = PlotView::bucketToX(bucket, lastBucket, width);
+        column.range = history.getMinMax(i, next);
+        column.last = history.getSiValueOrZero(next-1);
+        column.connected = !out.columns.empty() && bucket-out.columns.back().bucket <= maxGapBuckets;
+        out.columns.push_back(column);
+        i = next;
+    }
+}
+
+std::optional<PlotHover> findPlotHover(const History& history, int width, const PlotView& view, int mouseX)
+{
+    if (history.empty())
+        return {};
+
+    const int64_t lastBucket = view.getLastBucket(history);
+    const timestamp_t time = view.getBucketStart(PlotView::xToBucket(mouseX, lastBucket, width))+view.getPixelDuration()/2;
+    size_t i = history.findTime(time);
+    if (i == history.size() || (i && time-history.getTimestamp(i-1) < history.getTimestamp(i)-time))
+        --i;
+
+    const int x = PlotView::bucketToX(view.getBucket(history.getTimestamp(i)), lastBucket, width);
+    if (x < 0 || x > width)
+        return {};
+    return PlotHover{.x = x, .sample = i};
+}
+
+std::vector<PlotTick> findTimeTicks(const History& history, int width, const PlotView& view, int minSpacing,
+        LocalTimeFormatter& timeFormatter, PlotView::duration& step)
+{
+    using namespace std::chrono;
+    using namespace std::chrono_literals;
+    static constexpr std::array<PlotView::duration, 28> steps{
+        1ms, 2ms, 5ms, 10ms, 20ms, 50ms, 100ms, 200ms, 500ms,
+        1s, 2s, 5s, 10s, 15s, 30s,
+        1min, 2min, 5min, 10min, 15min, 30min,
+        1h, 2h, 3h, 6h, 12h, days{1}, days{7},
+    };
+
+    const PlotView::duration minStep = view.getPixelDuration()*minSpacing;
+    step = *std::min(std::lower_bound(steps.begin(), steps.end(), minStep), steps.end()-1);
+
+    const int64_t lastBucket = view.getLastBucket(history);
+    const timestamp_t begin = view.getBucketStart(lastBucket-width+1);
+    const timestamp_t end = view.getBucketStart(lastBucket+1);
+
+    // Stepped in local time, so the ticks are on the whole hours and days of the labels.
+    // 1970-01-01 was a Thursday, the weeks are shifted to start on Monday.
+    const PlotView::duration phase = step == days{7} ? days{4} : PlotView::duration{};
+    seconds offset = timeFormatter.getOffset(begin);
+    const PlotView::duration localBegin = begin.time_since_epoch()+offset-phase;
+    std::vector<PlotTick> ticks;
+    for (PlotView::duration local{-floorDiv(-localBegin.count(), step.count())*step+phase}; ; local += step)
+    {
+        // The offset at the tick, it changes when the clocks are set forward or back
+        timestamp_t time{local-offset};
+        offset = timeFormatter.getOffset(time);
+        time = timestamp_t{local-offset};
+        if (time >= end)
+            break;
+        // Around a change of the offset a local time may be skipped or happen twice
+        if (time < begin || (!ticks.empty() && time <= ticks.back().time))
+            continue;
+        ticks.push_back({.x = PlotView::bucketToX(view.getBucket(time), lastBucket, width), .time = time});
+    }
+    return ticks;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <vector>
+#include <stdint.h>
+#include "History.h"
+
+class LocalTimeFormatter;
+
+/*
+ * The part of the history the plot shows, on a time axis.
+ *
+ * The plot is made of columns, one pixel wide each, and a column covers
+ * `getPixelDuration()` of time. Columns are aligned to multiples of that
+ * (counted from the epoch), so they don't jitter as new samples arrive.
+ * The newest sample is at the right edge, unless the view is panned back in
+ * time. Samples further apart than `maxConnectedGap` aren't connected, so
+ * disconnects show up as gaps.
+ * The values are in the base unit, so the trace doesn't jump when the meter
+ * changes range.
+ */
+struct PlotView
+{
+    using duration = timestamp_t::duration;
+
+    static constexpr duration minPixelDuration = std::chrono::milliseconds{1};
+    // About 70 minutes per pixel
+    static constexpr int maxZoomLevel = 22;
+    static constexpr duration maxConnectedGap = std::chrono::seconds{2};
+
+    // A column is `minPixelDuration` times 2^`zoomLevel`
+    int zoomLevel{4};
+    // The time at the right edge, unset to follow the newest sample
+    std::optional<timestamp_t> end;
+
+    inline bool operator==(const PlotView&) const = default;
+
+    inline duration getPixelDuration() const { return minPixelDuration*(int64_t{1} << zoomLevel); }
+
+    // Positive steps zoom out, the right edge stays in place
+    void zoom(int steps);
+    // Moves the view `pixels` back in time, negative ones move it forward.
+    // Moving it past the newest sample follows that again, it stops at the oldest one.
+    void pan(const History& history, int pixels);
+
+    int64_t getBucket(const timestamp_t& time) const;
+    timestamp_t getBucketStart(int64_t bucket) const;
+    // The bucket of the column at the right edge
+    int64_t getLastBucket(const History& history) const;
+
+    // Between the buckets and the x coordinates when `lastBucket` is at the right edge
+    static int bucketToX(int64_t bucket, int64_t lastBucket, int width);
+    static inline int64_t xToBucket(int x, int64_t lastBucket, int width) { return lastBucket-(width-x); }
+};
+
+struct PlotColumn
+{
+    int64_t bucket{};
+    int x{};
+    MinMax range;
+    float last{};
+    // Whether the line continues from the previous column
+    bool connected{};
+};
+
+struct PlotData
+{
+    // Only the columns that have samples, from the oldest to the newest
+    std::vector<PlotColumn> columns;
+    // The largest absolute value on the screen, used for scaling
+    float maxAbs{};
+    // The bucket at the right edge
+    int64_t lastBucket{};
+};
+
+// Only prepares the columns starting at `firstBucket`, the scale is always calculated for the whole screen.
+// The first column is the last one before the screen (or before `firstBucket`) that has samples,
+// so the line leading into the screen is drawn the same way every time.
+void preparePlotData(const History& history, int width, const PlotView& view, PlotData& out, int64_t firstBucket=INT64_MIN);
+
+struct PlotHover
+{
+    int x{};
+    size_t sample{};
+};
+
+// Finds the sample closest in time to the mouse
+std::optional<PlotHover> findPlotHover(const History& history, int width, const PlotView& view, int mouseX);
+
+struct PlotTick
+{
+    int x{};
+    timestamp_t time;
+};
+
+// Round local times on the screen, at least `minSpacing` pixels apart, weeks start on Monday.
+// `step` is set to the time between them, the UTC offsets come from `timeFormatter`.
+std::vector<PlotTick> findTimeTicks(const History& history, int width, const PlotView& view, int minSpacing,
+        LocalTimeFormatter& timeFormatter, PlotView::duration& step);
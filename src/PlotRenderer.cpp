@@ -0,0 +1,256 @@
+#include "PlotRenderer.h"
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+bool PlotTrace::update(const History& history, int width, int height, const PlotView& newView)
+{
+    if (!back || back->get_width() != width || back->get_height() != height)
+    {
+        back = Cairo::ImageSurface::create(Cairo::ImageSurface::Format::ARGB32, width, height);
+        valid = false;
+    }
+
+    const bool canScroll = valid && history.getId() == historyId && newView == view
+        && front->get_width() == width && front->get_height() == height;
+    if (canScroll && history.size() == sampleCount)
+        return false;
+    const Diagnostics::clock::time_point start = Diagnostics::clock::now();
+
+    // The previously newest column may have been incomplete, so it is redrawn
+    // with the line leading into it. The data starts one column earlier, so
+    // that line is drawn the same way as in a full render.
+    preparePlotData(history, width, newView, plotData, canScroll ? redrawBucket : INT64_MIN);
+    const int64_t shift = plotData.lastBucket-lastBucket;
+
+    auto cont = Cairo::Context::create(back);
+    if (canScroll && plotData.maxAbs == maxAbs && shift < width)
+    {
+        cont->set_operator(Cairo::Context::Operator::SOURCE);
+        {
+            const std::unique_lock<std::mutex> guard = diagnostics.lock(frontMutex);
+            cont->set_source(front, -shift, 0);
+            cont->paint();
+        }
+
+        const int clipX = std::max(0, PlotView::bucketToX(redrawBucket, plotData.lastBucket, width));
+        cont->rectangle(clipX, 0, width-clipX, height);
+        cont->clip();
+    }
+    else if (canScroll)
+    {
+        preparePlotData(history, width, newView, plotData);
+    }
+    cont->set_operator(Cairo::Context::Operator::CLEAR);
+    cont->paint();
+    cont->set_operator(Cairo::Context::Operator::OVER);
+    render(cont, height);
+
+    {
+        const std::unique_lock<std::mutex> guard = diagnostics.lock(frontMutex);
+        std::swap(front, back);
+    }
+
+    valid = true;
+    historyId = history.getId();
+    view = newView;
+    maxAbs = plotData.maxAbs;
+    lastBucket = plotData.lastBucket;
+    const size_t columnCount = plotData.columns.size();
+    // Without a column before the newest one the next update redraws everything
+    redrawBucket = columnCount > 1 ? plotData.columns[columnCount-2].bucket : lastBucket-width;
+    sampleCount = history.size();
+    diagnostics.recordSince(Diagnostics::Stage::Render, start);
+    diagnostics.countRender();
+    return true;
+}
+
+void PlotTrace::paint(const Cairo::RefPtr<Cairo::Context>& cont)
+{
+    const std::unique_lock<std::mutex> guard = diagnostics.lock(frontMutex);
+    if (!front)
+        return;
+    cont->set_source(front, 0, 0);
+    cont->paint();
+}
+
+void PlotTrace::render(const Cairo::RefPtr<Cairo::Context>& cont, int height) const
+{
+    if (plotData.columns.empty())
+        return;
+
+    const double middleY = height/2.;
+    const auto toY{[&](float val){
+        const double diff = val/plotData.maxAbs*(middleY-10);
+        return middleY-(std::isnan(diff) || std::isinf(diff) ? 0 : diff);
+    }};
+
+    cont->set_line_width(1);
+    // Round joins never reach into the neighbouring columns, so partial redraws match full ones.
+    // Round caps show the samples that aren't connected to anything as dots.
+    cont->set_line_join(Cairo::Context::LineJoin::ROUND);
+    cont->set_line_cap(Cairo::Context::LineCap::ROUND);
+    cont->set_source_rgb(0.3, 1.0, 0.8);
+    for (const PlotColumn& column : plotData.columns)
+    {
+        // Draw the whole extent of the column so no peak is lost when zoomed out
+        if (column.connected)
+            cont->line_to(column.x, toY(column.range.max));
+        else
+            cont->move_to(column.x, toY(column.range.max));
+        cont->line_to(column.x, toY(column.range.min));
+        cont->line_to(column.x, toY(column.last));
+    }
+    cont->stroke();
+}
+
+PlotRenderer::PlotRenderer(BackgroundFunc renderBackground)
+    : renderBackground{std::move(renderBackground)}
+{
+}
+
+PlotRenderer::~PlotRenderer()
+{
+    stopThread();
+}
+
+void PlotRenderer::startThread(ReadyFunc onReady)
+{
+    if (thread.joinable())
+        return;
+    threadStopRequested = false;
+    thread = std::thread{&PlotRenderer::threadMain, this, std::move(onReady)};
+}
+
+void PlotRenderer::stopThread()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        const std::unique_lock<std::mutex> guard = diagnostics.lock(requestMutex);
+        threadStopRequested = true;
+    }
+    requestCond.notify_one();
+    thread.join();
+}
+
+void PlotRenderer::draw(const Cairo::RefPtr<Cairo::Context>& cont, const History& history, int width, int height, const PlotView& view)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    if (!background || background->get_width() != width || background->get_height() != height)
+        renderBackgroundImage(width, height);
+
+    if (thread.joinable())
+        requestTrace(history, width, height, view);
+    else
+        trace.update(history, width, height, view);
+
+    cont->set_source(background, 0, 0);
+    cont->paint();
+    trace.paint(cont);
+    paintTimeAxis(cont, history, width, height, view);
+}
+
+void PlotRenderer::paintTimeAxis(const Cairo::RefPtr<Cairo::Context>& cont, const History& history, int width, int height, const PlotView& view)
+{
+    if (history.empty())
+        return;
+
+    PlotView::duration step;
+    const std::vector<PlotTick> ticks = findTimeTicks(history, width, view, 120, timeFormatter, step);
+
+    // Only as precise as the step needs, out of `YYYY-MM-DDTHH:MM:SS.fff...`
+    using namespace std::chrono_literals;
+    const auto [labelBegin, labelSize] = step < 1s ? std::pair{11, 12}
+        : step < 1min ? std::pair{11, 8}
+        : step < 24h ? std::pair{11, 5}
+        : std::pair{5, 5};
+
+    cont->set_line_width(1);
+    cont->select_font_face("monospace", Cairo::ToyFontFace::Slant::NORMAL, Cairo::ToyFontFace::Weight::NORMAL);
+    cont->set_font_size(11);
+    char label[LocalTimeFormatter::maxSize];
+    for (const PlotTick& tick : ticks)
+    {
+        cont->set_source_rgba(0.6, 0.6, 0.6, 0.6);
+        cont->move_to(tick.x+0.5, height-16);
+        cont->line_to(tick.x+0.5, height);
+        cont->stroke();
+
+        timeFormatter.format(label, tick.time);
+        cont->set_source_rgb(0.8, 0.8, 0.8);
+        cont->move_to(tick.x+3, height-6);
+        cont->show_text(std::string{label+labelBegin, size_t(labelSize)});
+    }
+}
+
+void PlotRenderer::renderBackgroundImage(int width, int height)
+{
+    background = Cairo::ImageSurface::create(Cairo::ImageSurface::Format::ARGB32, width, height);
+
+    auto cont = Cairo::Context::create(background);
+    renderBackground(cont, width, height);
+
+    const double middleY = height/2.;
+    cont->set_source_rgba(0.1, 0.1, 0.1, 0.8);
+    cont->set_line_width(0.5);
+    for (int i{}; i < width/10; i++)
+    {
+        if (i % 2)
+        {
+            cont->move_to(i*10, middleY);
+            cont->line_to((i+1)*10, middleY);
+        }
+    }
+    cont->stroke();
+}
+
+void PlotRenderer::requestTrace(const History& history, int width, int height, const PlotView& view)
+{
+    if (requestedGeneration && history.getId() == requestedHistoryId && history.size() == requestedSampleCount
+            && width == requestedWidth && height == requestedHeight && view == requestedView)
+        return;
+
+    requestedHistoryId = history.getId();
+    requestedSampleCount = history.size();
+    requestedWidth = width;
+    requestedHeight = height;
+    requestedView = view;
+
+    {
+        const std::unique_lock<std::mutex> guard = diagnostics.lock(requestMutex);
+        pendingRequest = Request{
+            .history = history.snapshot(),
+            .width = width,
+            .height = height,
+            .view = view,
+            .generation = ++requestedGeneration,
+        };
+    }
+    requestCond.notify_one();
+}
+
+void PlotRenderer::threadMain(ReadyFunc onReady)
+{
+    while (true)
+    {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock{requestMutex};
+            requestCond.wait(lock, [this](){ return threadStopRequested || pendingRequest.has_value(); });
+            if (threadStopRequested)
+                break;
+            request = std::move(*pendingRequest);
+            pendingRequest.reset();
+        }
+
+        const bool changed = trace.update(*request.history, request.width, request.height, request.view);
+        completedGeneration = request.generation;
+        if (changed)
+            onReady();
+    }
+}
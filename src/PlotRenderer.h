@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <cairomm/context.h>
+#include <cairomm/surface.h>
+#include "Diagnostics.h"
+#include "History.h"
+#include "LocalTime.h"
+#include "PlotData.h"
+
+/*
+ * The trace of the plot, kept in two offscreen surfaces.
+ *
+ * When new samples arrive, the front image is shifted into the back one and
+ * only the newest columns are drawn, then the two are swapped. The whole trace
+ * is only re-rendered when the size, the view or the scale changes.
+ * Updating and painting may happen on different threads.
+ */
+class PlotTrace
+{
+public:
+    // Brings the trace up to date, returns false if it already was
+    bool update(const History& history, int width, int height, const PlotView& view);
+
+    // Paints the latest completed image
+    void paint(const Cairo::RefPtr<Cairo::Context>& cont);
+
+private:
+    // Guards `front`
+    std::mutex frontMutex;
+    Cairo::RefPtr<Cairo::ImageSurface> front;
+    Cairo::RefPtr<Cairo::ImageSurface> back;
+
+    // The state the front image was rendered with
+    bool valid{};
+    uint64_t historyId{};
+    PlotView view;
+    float maxAbs{};
+    int64_t lastBucket{};
+    // The column before the newest one, new samples may change everything after it
+    int64_t redrawBucket{};
+    size_t sampleCount{};
+
+    PlotData plotData;
+
+    void render(const Cairo::RefPtr<Cairo::Context>& cont, int height) const;
+};
+
+/*
+ * Draws the plot from cached images.
+ *
+ * The background is only re-rendered when the size changes.
+ * The trace is either updated in `draw`, or if the render thread is running,
+ * `draw` only sends it a snapshot of the history and paints the latest image
+ * it has completed.
+ */
+class PlotRenderer
+{
+public:
+    using BackgroundFunc = std::function<void(const Cairo::RefPtr<Cairo::Context>&, int width, int height)>;
+    using ReadyFunc = std::function<void()>;
+
+    explicit PlotRenderer(BackgroundFunc renderBackground);
+    ~PlotRenderer();
+
+    // `onReady` is called from the render thread when a new image is completed
+    void startThread(ReadyFunc onReady);
+    void stopThread();
+
+    // Brings the images up to date and paints them
+    void draw(const Cairo::RefPtr<Cairo::Context>& cont, const History& history, int width, int height, const PlotView& view);
+
+    // Increases with every request sent to the render thread
+    inline uint64_t getRequestedGeneration() const { return requestedGeneration; }
+    // The latest request the render thread has completed
+    inline uint64_t getCompletedGeneration() const { return completedGeneration; }
+
+private:
+    BackgroundFunc renderBackground;
+    Cairo::RefPtr<Cairo::ImageSurface> background;
+    PlotTrace trace;
+    LocalTimeFormatter timeFormatter;
+
+    struct Request
+    {
+        std::shared_ptr<const History> history;
+        int width{};
+        int height{};
+        PlotView view;
+        uint64_t generation{};
+    };
+
+    std::thread thread;
+    std::mutex requestMutex;
+    std::condition_variable requestCond;
+    // Only the latest request is kept, the render thread skips the ones it didn't get to
+    std::optional<Request> pendingRequest;
+    bool threadStopRequested{};
+
+    uint64_t requestedGeneration{};
+    std::atomic<uint64_t> completedGeneration{};
+    // What the last request was made for, so the same image isn't requested again
+    uint64_t requestedHistoryId{};
+    size_t requestedSampleCount{};
+    int requestedWidth{};
+    int requestedHeight{};
+    PlotView requestedView;
+
+    void renderBackgroundImage(int width, int height);
+    void requestTrace(const History& history, int width, int height, const PlotView& view);
+    // The time labels change with every scroll, so they're painted over the images
+    void paintTimeAxis(const Cairo::RefPtr<Cairo::Context>& cont, const History& history, int width, int height, const PlotView& view);
+    void threadMain(ReadyFunc onReady);
+};
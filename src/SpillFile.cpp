@@ -0,0 +1,81 @@
+#include "SpillFile.h"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "Log.h"
+
+SpillFile::~SpillFile()
+{
+    close();
+}
+
+bool SpillFile::open(const std::string& dir)
+{
+    close();
+
+#ifdef O_TMPFILE
+    fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd == -1)
+    {
+        // Not supported by the kernel or the file system, unlink it ourselves
+        std::string path = dir+"/mx-ui-spill-XXXXXX";
+        std::vector<char> buf(path.begin(), path.end()+1);
+        fd = mkostemp(buf.data(), O_CLOEXEC);
+        if (fd != -1)
+            unlink(buf.data());
+    }
+    if (fd == -1)
+    {
+        LOG_ERROR("Failed to create a spill file in {}: {}", dir, strerror(errno));
+        return false;
+    }
+    fileSize = 0;
+    return true;
+}
+
+void SpillFile::close()
+{
+    if (fd != -1)
+        ::close(fd);
+    fd = -1;
+    fileSize = 0;
+}
+
+std::shared_ptr<const uint8_t> SpillFile::store(const uint8_t* data, size_t size)
+{
+    if (fd == -1 || size == 0)
+        return {};
+
+    // Every block is mapped on its own, so it starts on a page
+    const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    const uint64_t offset = (fileSize+pageSize-1) / pageSize * pageSize;
+    for (size_t written{}; written < size; )
+    {
+        const ssize_t result = pwrite(fd, data+written, size-written, offset+written);
+        if (result == -1 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            LOG_ERROR("Failed to write the spill file: {}", strerror(errno));
+            close();
+            return {};
+        }
+        written += result;
+    }
+
+    void* const mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, offset);
+    if (mapping == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map the spill file: {}", strerror(errno));
+        close();
+        return {};
+    }
+    fileSize = offset+size;
+    return std::shared_ptr<const uint8_t>{static_cast<const uint8_t*>(mapping), [size](const uint8_t* p){
+        munmap(const_cast<uint8_t*>(p), size);
+    }};
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+/*
+ * Scratch file on disk for data that doesn't fit in the memory budget.
+ *
+ * The file is unlinked right after it's created, so it goes away when the
+ * app exits, even if it crashes. Stored blocks are mapped back read-only:
+ * the kernel pages them in when they're read and can drop them again when
+ * the memory is needed, so they don't count against the budget.
+ * Only the owner thread stores, the mappings can be read from any thread.
+ */
+class SpillFile
+{
+public:
+    SpillFile() = default;
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+    ~SpillFile();
+
+    // Creates the file in the directory `dir`
+    bool open(const std::string& dir);
+    // The blocks that were stored stay mapped until they are released
+    void close();
+    inline bool isOpen() const { return fd != -1; }
+
+    // Appends a copy of the block and returns its mapping.
+    // On error it returns null and closes the file, the disk is probably full.
+    std::shared_ptr<const uint8_t> store(const uint8_t* data, size_t size);
+
+    // Bytes on disk
+    inline uint64_t getSize() const { return fileSize; }
+
+private:
+    int fd{-1};
+    uint64_t fileSize{};
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded lock-free single-producer/single-consumer ring buffer.
+ *
+ * The producer never waits: when the ring is full, the new element is dropped
+ * and counted, the elements already queued are kept.
+ */
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert((Capacity & (Capacity-1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side
+    bool tryPush(const T& value)
+    {
+        const size_t write = writeIndex.load(std::memory_order_relaxed);
+        if (write - readIndex.load(std::memory_order_acquire) == Capacity)
+        {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[write & (Capacity-1)] = value;
+        writeIndex.store(write+1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool tryPop(T& value)
+    {
+        const size_t read = readIndex.load(std::memory_order_relaxed);
+        if (read == writeIndex.load(std::memory_order_acquire))
+            return false;
+        value = slots[read & (Capacity-1)];
+        readIndex.store(read+1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, calls `func` for every queued element, returns the count
+    template <typename F>
+    size_t drain(F&& func)
+    {
+        const size_t read = readIndex.load(std::memory_order_relaxed);
+        const size_t write = writeIndex.load(std::memory_order_acquire);
+        for (size_t i=read; i != write; ++i)
+            func(slots[i & (Capacity-1)]);
+        readIndex.store(write, std::memory_order_release);
+        return write-read;
+    }
+
+    // Either side, may be out of date by the time it returns
+    inline size_t size() const
+    {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+
+    // Consumer side
+    inline bool empty() const
+    {
+        return readIndex.load(std::memory_order_relaxed) == writeIndex.load(std::memory_order_acquire);
+    }
+
+    inline uint64_t getDropCount() const { return dropCount.load(std::memory_order_relaxed); }
+
+private:
+    std::array<T, Capacity> slots{};
+    alignas(64) std::atomic<size_t> writeIndex{};
+    alignas(64) std::atomic<size_t> readIndex{};
+    alignas(64) std::atomic<uint64_t> dropCount{};
+};
@@ -0,0 +1,225 @@
+#include "Statistics.h"
+#include <charconv>
+#include <cmath>
+#include <format>
+
+void RunningStats::add(double value)
+{
+    ++count;
+    const double delta = value-mean;
+    mean += delta/count;
+    m2 += delta*(value-mean);
+    sumSquares += value*value;
+}
+
+void RunningStats::remove(double value)
+{
+    if (count <= 1)
+        return clear();
+
+    --count;
+    const double delta = value-mean;
+    mean -= delta/count;
+    // Rounding errors could make it slightly negative
+    m2 = std::max(0.0, m2-delta*(value-mean));
+    sumSquares = std::max(0.0, sumSquares-value*value);
+}
+
+void RunningStats::clear()
+{
+    *this = {};
+}
+
+double RunningStats::getVariance() const
+{
+    return count > 1 ? m2/(count-1) : 0;
+}
+
+double RunningStats::getRms() const
+{
+    return count ? std::sqrt(sumSquares/count) : NAN;
+}
+
+WindowStats::WindowStats(std::chrono::nanoseconds length)
+    : length{length}
+{
+}
+
+void WindowStats::reset(size_t index)
+{
+    begin = index;
+    end = index;
+    overloads = 0;
+    values.clear();
+    minCandidates.clear();
+    maxCandidates.clear();
+}
+
+void WindowStats::update(const History& history, size_t newEnd)
+{
+    for (; end < newEnd; ++end)
+    {
+        const float value = history.getSiValue(end);
+        if (std::isnan(value))
+        {
+            ++overloads;
+        }
+        else
+        {
+            values.add(value);
+            while (!minCandidates.empty() && history.getSiValue(minCandidates.back()) >= value)
+                minCandidates.pop_back();
+            minCandidates.push_back(end);
+            while (!maxCandidates.empty() && history.getSiValue(maxCandidates.back()) <= value)
+                maxCandidates.pop_back();
+            maxCandidates.push_back(end);
+        }
+
+        if (length != std::chrono::nanoseconds::zero())
+            evict(history, history.getTimestamp(end)-length);
+    }
+}
+
+void WindowStats::evict(const History& history, const timestamp_t& cutoff)
+{
+    for (; begin < end && history.getTimestamp(begin) <= cutoff; ++begin)
+    {
+        const float value = history.getSiValue(begin);
+        if (std::isnan(value))
+        {
+            --overloads;
+            continue;
+        }
+        values.remove(value);
+        if (minCandidates.front() == begin)
+            minCandidates.pop_front();
+        if (maxCandidates.front() == begin)
+            maxCandidates.pop_front();
+    }
+}
+
+StatsSummary WindowStats::getSummary(const History& history) const
+{
+    StatsSummary summary;
+    summary.count = values.getCount();
+    summary.overloads = overloads;
+    if (begin == end)
+        return summary;
+
+    summary.unit = {Frame::Unit::Prefix::None, history.getUnit(end-1).base};
+    if (summary.count)
+    {
+        summary.min = history.getSiValue(minCandidates.front());
+        summary.max = history.getSiValue(maxCandidates.front());
+        summary.mean = values.getMean();
+        summary.stdDev = std::sqrt(values.getVariance());
+        summary.rms = values.getRms();
+    }
+    const std::chrono::duration<double> span = history.getTimestamp(end-1)-history.getTimestamp(begin);
+    if (span.count() > 0)
+        summary.sampleRate = (end-begin-1)/span.count();
+    return summary;
+}
+
+StatsEngine::StatsEngine()
+    : StatsEngine{{std::begin(defaultWindows), std::end(defaultWindows)}}
+{
+}
+
+StatsEngine::StatsEngine(const std::vector<std::chrono::nanoseconds>& windowLengths)
+{
+    for (const auto length : windowLengths)
+        windows.emplace_back(length);
+}
+
+void StatsEngine::reset(size_t index)
+{
+    session.reset(index);
+    for (auto& window : windows)
+        window.reset(index);
+}
+
+void StatsEngine::update(const History& history)
+{
+    if (history.getId() != historyId)
+    {
+        historyId = history.getId();
+        processed = 0;
+        unitBase = 0;
+        reset(0);
+    }
+
+    constexpr uint16_t baseMask = History::unitFieldMask << History::unitBaseShift;
+    while (processed < history.size())
+    {
+        // Take in the readings until the next base unit change at once
+        size_t batchEnd = processed;
+        const uint16_t base = history.getFlags(processed) & baseMask;
+        if (base != unitBase)
+        {
+            unitBase = base;
+            reset(processed);
+        }
+        while (batchEnd < history.size() && (history.getFlags(batchEnd) & baseMask) == base)
+            ++batchEnd;
+
+        session.update(history, batchEnd);
+        for (auto& window : windows)
+            window.update(history, batchEnd);
+        processed = batchEnd;
+    }
+}
+
+std::string StatsEngine::formatLength(std::chrono::nanoseconds length)
+{
+    using namespace std::chrono;
+    if (length % hours{1} == nanoseconds::zero())
+        return std::format("{}h", duration_cast<hours>(length).count());
+    if (length % minutes{1} == nanoseconds::zero())
+        return std::format("{}min", duration_cast<minutes>(length).count());
+    return std::format("{}s", duration_cast<duration<double>>(length).count());
+}
+
+bool StatsEngine::lengthFromStr(std::string_view str, std::chrono::nanoseconds& out)
+{
+    const char* const end = str.data()+str.size();
+    double number;
+    const auto [numberEnd, error] = std::from_chars(str.data(), end, number);
+    if (error != std::errc{} || !(number > 0))
+        return false;
+    const std::string_view suffix{numberEnd, size_t(end-numberEnd)};
+    double factor;
+    if (suffix == "ms")
+        factor = 1e6;
+    else if (suffix == "s")
+        factor = 1e9;
+    else if (suffix == "min")
+        factor = 60e9;
+    else if (suffix == "h")
+        factor = 3600e9;
+    else
+        return false;
+    // Also rejects what doesn't fit
+    if (!(number*factor < 9e18))
+        return false;
+    out = std::chrono::nanoseconds{int64_t(number*factor)};
+    return out.count() > 0;
+}
+
+std::string StatsEngine::formatTable(const History& history, const std::string& linePrefix) const
+{
+    const StatsSummary sessionStats = getSession(history);
+    std::string table = std::format("{}Statistics in {}, {} readings, {} overloads\n", linePrefix,
+            Frame::unitToStr(sessionStats.unit), sessionStats.count, sessionStats.overloads);
+    table += std::format("{}{:<6}{:>11}{:>11}{:>11}{:>11}{:>11}{:>9}\n", linePrefix,
+            "", "Min", "Max", "Mean", "Std.dev.", "RMS", "Rate/s");
+
+    const auto addRow{[&](const std::string& name, const StatsSummary& stats){
+        table += std::format("{}{:<6}{:>11.5g}{:>11.5g}{:>11.5g}{:>11.5g}{:>11.5g}{:>9.3g}\n", linePrefix,
+                name, stats.min, stats.max, stats.mean, stats.stdDev, stats.rms, stats.sampleRate);
+    }};
+    addRow("All", sessionStats);
+    for (size_t i{}; i < windows.size(); ++i)
+        addRow(formatLength(getWindowLength(i)), getWindow(history, i));
+    return table;
+}
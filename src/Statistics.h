@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "History.h"
+
+// Mean and variance with Welford's method, values can also be taken out
+class RunningStats
+{
+public:
+    void add(double value);
+    // `value` must have been added before
+    void remove(double value);
+    void clear();
+
+    inline size_t getCount() const { return count; }
+    inline double getMean() const { return mean; }
+    // Sample variance
+    double getVariance() const;
+    double getRms() const;
+
+private:
+    size_t count{};
+    double mean{};
+    double m2{};
+    double sumSquares{};
+};
+
+struct StatsSummary
+{
+    // Readings with a value, overloads are only counted
+    size_t count{};
+    size_t overloads{};
+    float min{NAN};
+    float max{NAN};
+    double mean{NAN};
+    double stdDev{NAN};
+    double rms{NAN};
+    // Readings per second over the time covered
+    double sampleRate{NAN};
+    // The unit of the values, always without prefix
+    Frame::Unit unit{Frame::Unit::Prefix::None, Frame::Unit::Base::Volt};
+};
+
+/*
+ * Statistics of the SI values of the readings in the last `length` time
+ * (or all of them with a length of zero), ending at the newest reading.
+ *
+ * The window is a range of indices in the `History`, so it stores nothing per
+ * reading except the candidates for the extrema, which are kept in monotonic
+ * deques. Every reading enters and leaves once, O(1) amortized.
+ */
+class WindowStats
+{
+public:
+    explicit WindowStats(std::chrono::nanoseconds length);
+
+    // Starts over from the reading `index`
+    void reset(size_t index);
+    // Takes in the readings until `end` and drops the ones that fell out
+    void update(const History& history, size_t end);
+    StatsSummary getSummary(const History& history) const;
+
+    inline std::chrono::nanoseconds getLength() const { return length; }
+
+private:
+    std::chrono::nanoseconds length;
+    size_t begin{};
+    size_t end{};
+    size_t overloads{};
+    RunningStats values;
+    // Indices with increasing values for the minimum, decreasing for the maximum
+    std::deque<size_t> minCandidates;
+    std::deque<size_t> maxCandidates;
+
+    // Drops the readings not newer than `cutoff`
+    void evict(const History& history, const timestamp_t& cutoff);
+};
+
+/*
+ * Live statistics of a `History`: over the whole session and over trailing windows.
+ *
+ * Everything starts over when the base unit changes (e.g. from volts to
+ * ohms), a prefix change doesn't matter as the SI values are used.
+ */
+class StatsEngine
+{
+public:
+    static constexpr std::chrono::seconds defaultWindows[]{
+        std::chrono::seconds{10}, std::chrono::minutes{1}, std::chrono::hours{1}};
+
+    StatsEngine();
+    explicit StatsEngine(const std::vector<std::chrono::nanoseconds>& windowLengths);
+
+    // Takes in the readings appended since the last call
+    void update(const History& history);
+
+    inline StatsSummary getSession(const History& history) const { return session.getSummary(history); }
+    inline size_t getWindowCount() const { return windows.size(); }
+    inline std::chrono::nanoseconds getWindowLength(size_t i) const { return windows[i].getLength(); }
+    inline StatsSummary getWindow(const History& history, size_t i) const { return windows[i].getSummary(history); }
+
+    // Like "10s", "1min" or "1h"
+    static std::string formatLength(std::chrono::nanoseconds length);
+    // `NUMBER(ms|s|min|h)`, like the durations of the triggers, false unless it's positive
+    static bool lengthFromStr(std::string_view str, std::chrono::nanoseconds& out);
+    // A table of the session and the windows, every line starts with `linePrefix`
+    std::string formatTable(const History& history, const std::string& linePrefix={}) const;
+
+private:
+    uint64_t historyId{};
+    size_t processed{};
+    uint16_t unitBase{};
+    WindowStats session{std::chrono::nanoseconds::zero()};
+    std::vector<WindowStats> windows;
+
+    void reset(size_t index);
+};
@@ -0,0 +1,430 @@
+#include "StreamServer.h"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <string_view>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "BatchDecoder.h"
+#include "History.h"
+#include "Log.h"
+
+#define MAX_EVENTS 64
+#define LISTEN_BACKLOG 16
+
+static constexpr std::string_view header = "Device;Value;Unit;Timestamp\n";
+
+StreamServer::Channel::Channel(StreamServer& server, std::string name)
+    : server{server}, name{std::move(name)}
+{
+}
+
+void StreamServer::Channel::publish(const uint8_t bytes[14], const timestamp_t& time)
+{
+    Record record;
+    record.time = time;
+    std::copy(bytes, bytes+14, record.bytes);
+    // Dropped if the server thread is that far behind
+    queue.tryPush(record);
+    if (!server.wakeupPending.exchange(true))
+        server.wake();
+}
+
+StreamServer::~StreamServer()
+{
+    stop();
+}
+
+bool StreamServer::start(const std::string& socketPath, uint16_t tcpPort)
+{
+    if (thread.joinable())
+        return true;
+
+    if (!socketPath.empty())
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        struct stat info{};
+        const bool exists = lstat(socketPath.c_str(), &info) == 0;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            LOG_ERROR("Stream socket path is too long: {}", socketPath);
+        }
+        else if (exists && !S_ISSOCK(info.st_mode))
+        {
+            LOG_ERROR("Not streaming on {}, it exists and isn't a socket", socketPath);
+        }
+        else
+        {
+            std::copy(socketPath.begin(), socketPath.end(), address.sun_path);
+            // Left behind by an earlier run that didn't stop cleanly
+            if (exists)
+                unlink(socketPath.c_str());
+            unixFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (unixFd == -1 || bind(unixFd, (const sockaddr*)&address, sizeof(address)) == -1
+                    || listen(unixFd, LISTEN_BACKLOG) == -1)
+            {
+                LOG_ERROR("Failed to listen on {}: {}", socketPath, strerror(errno));
+                if (unixFd != -1)
+                    close(unixFd);
+                unixFd = -1;
+            }
+            else
+            {
+                this->socketPath = socketPath;
+                LOG_INFO("Streaming the readings on {}", socketPath);
+            }
+        }
+    }
+
+    if (tcpPort)
+    {
+        // Only local processes, the stream isn't authenticated
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(tcpPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const int one = 1;
+        tcpFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (tcpFd == -1 || setsockopt(tcpFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1
+                || bind(tcpFd, (const sockaddr*)&address, sizeof(address)) == -1
+                || listen(tcpFd, LISTEN_BACKLOG) == -1)
+        {
+            LOG_ERROR("Failed to listen on 127.0.0.1:{}: {}", tcpPort, strerror(errno));
+            if (tcpFd != -1)
+                close(tcpFd);
+            tcpFd = -1;
+        }
+        else
+        {
+            LOG_INFO("Streaming the readings on 127.0.0.1:{}", tcpPort);
+        }
+    }
+
+    if (unixFd == -1 && tcpFd == -1)
+        return false;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd == -1 || eventFd == -1)
+    {
+        LOG_ERROR("Failed to create stream server loop: {}", strerror(errno));
+        stop();
+        return false;
+    }
+    for (const int fd : {eventFd, unixFd, tcpFd})
+    {
+        if (fd == -1)
+            continue;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    backlog.resize(minBacklogSize);
+    stopRequested = false;
+    thread = std::thread{&StreamServer::threadMain, this};
+    return true;
+}
+
+void StreamServer::stop()
+{
+    if (thread.joinable())
+    {
+        stopRequested = true;
+        wake();
+        thread.join();
+    }
+    for (int* fd : {&unixFd, &tcpFd, &epollFd, &eventFd})
+    {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+    }
+    if (!socketPath.empty())
+        unlink(socketPath.c_str());
+    socketPath.clear();
+}
+
+StreamServer::Channel& StreamServer::addChannel(std::string name)
+{
+    std::unique_ptr<Channel> channel{new Channel{*this, std::move(name)}};
+    const std::lock_guard<std::mutex> guard{mutex};
+    channels.push_back(std::move(channel));
+    return *channels.back();
+}
+
+void StreamServer::wake()
+{
+    if (eventFd == -1)
+        return;
+    const uint64_t one = 1;
+    if (write(eventFd, &one, sizeof(one)) == -1)
+        LOG_LIMITED(Error, std::chrono::seconds{1}, "Failed to signal stream server: {}", strerror(errno));
+}
+
+void StreamServer::threadMain()
+{
+    epoll_event events[MAX_EVENTS];
+    while (!stopRequested)
+    {
+        const int eventCount = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (eventCount == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait() error: {}", strerror(errno));
+            break;
+        }
+
+        bool gotFrames{};
+        for (int i{}; i < eventCount; ++i)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == eventFd)
+            {
+                uint64_t value;
+                if (read(eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                    LOG_LIMITED(Error, std::chrono::seconds{1}, "Failed to read eventfd: {}", strerror(errno));
+                gotFrames = true;
+                continue;
+            }
+            if (fd == unixFd || fd == tcpFd)
+            {
+                accept(fd);
+                continue;
+            }
+
+            const auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+            {
+                disconnect(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+            {
+                // The clients have nothing to say, anything they send is ignored
+                char buf[256];
+                ssize_t size;
+                while ((size = recv(fd, buf, sizeof(buf), 0)) > 0)
+                    ;
+                if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    disconnect(fd);
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLOUT)
+                flush(fd, it->second);
+        }
+
+        if (!gotFrames)
+            continue;
+        // The clients get what they can take between the rounds, so one that keeps up is never too far behind
+        bool moreFrames{true};
+        while (moreFrames)
+        {
+            moreFrames = takeFrames();
+            for (auto it = clients.begin(); it != clients.end();)
+            {
+                const int fd = it->first;
+                Client& client = (it++)->second;
+                if (!client.blocked)
+                    flush(fd, client);
+            }
+        }
+    }
+
+    while (!clients.empty())
+        disconnect(clients.begin()->first);
+}
+
+void StreamServer::accept(int listenFd)
+{
+    while (true)
+    {
+        sockaddr_storage address{};
+        socklen_t addressSize = sizeof(address);
+        const int fd = accept4(listenFd, (sockaddr*)&address, &addressSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                LOG_LIMITED(Error, std::chrono::seconds{1}, "Failed to accept a stream client: {}", strerror(errno));
+            return;
+        }
+        if (clients.size() == maxClients)
+        {
+            LOG_LIMITED(Warning, std::chrono::seconds{1}, "Refusing a stream client, there are already {}", maxClients);
+            close(fd);
+            continue;
+        }
+
+        std::string peer = "local";
+        if (address.ss_family == AF_INET)
+        {
+            const sockaddr_in& inet = reinterpret_cast<const sockaddr_in&>(address);
+            char host[INET_ADDRSTRLEN]{};
+            inet_ntop(AF_INET, &inet.sin_addr, host, sizeof(host));
+            peer = std::format("{}:{}", host, ntohs(inet.sin_port));
+        }
+
+        // The socket buffer is empty, the header always fits
+        if (send(fd, header.data(), header.size(), MSG_NOSIGNAL) != ssize_t(header.size()))
+        {
+            LOG_WARNING("Failed to send the header to stream client {}: {}", peer, strerror(errno));
+            close(fd);
+            continue;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        // Only the frames from now on
+        clients[fd] = Client{.offset=backlogEnd, .blocked=false, .peer=peer};
+        LOG_INFO("Stream client {} connected, {} in total", peer, clients.size());
+    }
+}
+
+bool StreamServer::takeFrames()
+{
+    // Cleared before the queues are drained, a frame pushed after the drain signals again
+    wakeupPending = false;
+
+    std::vector<Channel*> current;
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        for (const std::unique_ptr<Channel>& channel : channels)
+            current.push_back(channel.get());
+    }
+    const size_t neededSize = std::bit_ceil(current.size()*queueSize*maxLineSize);
+    if (neededSize > backlog.size())
+        growBacklog(neededSize);
+
+    size_t encoded{};
+    bool moreFrames{};
+    for (Channel* channel : current)
+    {
+        Channel::Record record;
+        while (true)
+        {
+            if (encoded+maxLineSize > backlog.size())
+            {
+                moreFrames = true;
+                break;
+            }
+            if (!channel->queue.tryPop(record))
+                break;
+
+            History::raw_t raw;
+            packFrame(record.bytes, raw);
+            const DecodedFrame decoded = decodePackedFrame(raw);
+
+            char line[maxLineSize];
+            char* out = line;
+            out = std::copy_n(channel->name.begin(), std::min<size_t>(channel->name.size(), 128), out);
+            *out++ = ';';
+            out = std::to_chars(out, out+32, decoded.value).ptr;
+            *out++ = ';';
+            const std::string& unit = Frame::unitToStr(History::unpackUnit(decoded.flags));
+            out = std::copy(unit.begin(), unit.end(), out);
+            *out++ = ';';
+            out = timeFormatter.format(out, record.time);
+            *out++ = '\n';
+
+            // Wraps around the end of the backlog
+            const size_t size = out-line;
+            const size_t begin = backlogEnd % backlog.size();
+            const size_t first = std::min(size, backlog.size()-begin);
+            std::copy(line, line+first, backlog.data()+begin);
+            std::copy(line+first, out, backlog.data());
+            backlogEnd += size;
+            encoded += size;
+        }
+    }
+
+    // Their next lines were just overwritten
+    for (auto it = clients.begin(); it != clients.end();)
+    {
+        const int fd = it->first;
+        const Client& client = (it++)->second;
+        if (backlogEnd-client.offset > backlog.size())
+        {
+            LOG_WARNING("Stream client {} is too slow, disconnecting it", client.peer);
+            disconnect(fd);
+        }
+    }
+    return moreFrames;
+}
+
+void StreamServer::growBacklog(size_t size)
+{
+    LOG_DEBUG("Growing the stream backlog to {} MiB", size >> 20);
+    std::vector<char> grown(size);
+    const uint64_t begin = backlogEnd-std::min<uint64_t>(backlogEnd, backlog.size());
+    for (uint64_t i = begin; i < backlogEnd; ++i)
+        grown[i % size] = backlog[i % backlog.size()];
+    backlog = std::move(grown);
+}
+
+bool StreamServer::flush(int fd, Client& client)
+{
+    while (client.offset != backlogEnd)
+    {
+        const size_t begin = client.offset % backlog.size();
+        const size_t size = backlogEnd-client.offset;
+        const size_t first = std::min(size, backlog.size()-begin);
+        iovec parts[]{
+            {.iov_base=backlog.data()+begin, .iov_len=first},
+            {.iov_base=backlog.data(), .iov_len=size-first},
+        };
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = size == first ? 1 : 2;
+        const ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (sent == -1)
+        {
+            LOG_INFO("Stream client {} disconnected: {}", client.peer, strerror(errno));
+            disconnect(fd);
+            return false;
+        }
+        client.offset += sent;
+    }
+
+    // Only woken up by a full socket buffer draining while it's behind
+    const bool blocked = client.offset != backlogEnd;
+    if (blocked != client.blocked)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (blocked ? uint32_t(EPOLLOUT) : 0);
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+        client.blocked = blocked;
+    }
+    return true;
+}
+
+void StreamServer::disconnect(int fd)
+{
+    const auto it = clients.find(fd);
+    if (it == clients.end())
+        return;
+    LOG_DEBUG("Stream client {} closed", it->second.peer);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(it);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "Frame.h"
+#include "LocalTime.h"
+#include "SpscRing.h"
+
+/*
+ * Streams the live frames of the devices to local clients, over a Unix domain
+ * socket, TCP on the loopback interface, or both.
+ *
+ * A client gets the header `Device;Value;Unit;Timestamp`, then a line for every
+ * frame read after it connected, like the rows of an export with the name of
+ * the device in front.
+ * The I/O threads hand the frames over through a lock-free queue per device
+ * and never wait. The server thread encodes every line once into a backlog
+ * shared by the clients, a client is only its position in it. One that falls
+ * behind by more than the backlog is disconnected, so neither the acquisition
+ * nor the other clients ever wait for a slow one. The backlog holds at least
+ * everything the queues can, so a burst alone doesn't push out a client that
+ * was keeping up.
+ */
+class StreamServer
+{
+public:
+    // Frames per device that can wait for the server thread
+    static constexpr size_t queueSize = 1024;
+    // Bytes of the lines kept for the clients at least, the most a client can be behind
+    static constexpr size_t minBacklogSize = 1 << 20;
+    // Connections over this are refused
+    static constexpr size_t maxClients = 256;
+
+    class Channel
+    {
+    public:
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        // Called by the I/O thread for every frame
+        void publish(const uint8_t bytes[14], const timestamp_t& time);
+
+    private:
+        friend class StreamServer;
+
+        struct Record
+        {
+            timestamp_t time;
+            uint8_t bytes[14];
+        };
+
+        StreamServer& server;
+        std::string name;
+        SpscRing<Record, queueSize> queue;
+
+        Channel(StreamServer& server, std::string name);
+    };
+
+    StreamServer() = default;
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+    ~StreamServer();
+
+    // Listens on `socketPath` (replacing a stale socket, but nothing else) when it's not empty, and
+    // on `tcpPort` of the loopback interface when it's not 0. Returns false if
+    // it couldn't listen on any of them.
+    bool start(const std::string& socketPath, uint16_t tcpPort);
+    // Disconnects the clients and removes the socket, call after the I/O threads stopped
+    void stop();
+
+    // Lives as long as the server. `name` is the device of the lines.
+    Channel& addChannel(std::string name);
+
+private:
+    struct Client
+    {
+        // Absolute position in the backlog of the next byte to send
+        uint64_t offset{};
+        // Waiting for the socket to become writable
+        bool blocked{};
+        std::string peer;
+    };
+
+    std::string socketPath;
+    int unixFd{-1};
+    int tcpFd{-1};
+    int epollFd{-1};
+    // Signalled when there are new frames or the server should stop
+    int eventFd{-1};
+    std::thread thread;
+    std::atomic<bool> stopRequested{};
+    // Set until the server thread takes the frames, so only the first new one signals it
+    std::atomic<bool> wakeupPending{};
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Channel>> channels;
+
+    // Only accessed by the server thread
+    // Device, value, unit and timestamp, the name is cut
+    static constexpr size_t maxLineSize = 256;
+
+    // Wraps around, grows with the devices
+    std::vector<char> backlog;
+    uint64_t backlogEnd{};
+    std::map<int, Client> clients;
+    LocalTimeFormatter timeFormatter;
+
+    void wake();
+    void threadMain();
+    void accept(int listenFd);
+    // Encodes the queued frames into the backlog, up to its size, so a client that had everything
+    // is still in it. Returns true if frames were left in the queues.
+    bool takeFrames();
+    // Keeps the lines in it at their positions
+    void growBacklog(size_t size);
+    // Sends what the client hasn't got yet, returns false if it was disconnected
+    bool flush(int fd, Client& client);
+    void disconnect(int fd);
+};
@@ -0,0 +1,429 @@
+#include "Trigger.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "BatchDecoder.h"
+#include "History.h"
+#include "Journal.h"
+#include "LocalTime.h"
+#include "Log.h"
+
+namespace
+{
+
+// The readings of two samples can't be compared when these differ. The prefix
+// isn't one of them, a meter in auto range changes it all the time.
+constexpr uint16_t modeMask = History::unitFieldMask << History::unitBaseShift
+    | History::FlagAC | History::FlagDC | History::FlagDiode;
+
+// `VALUE[UNIT]`, the value is converted to the base unit
+bool parseValue(std::string_view str, double& value, std::optional<Frame::Unit::Base>& base)
+{
+    const char* const end = str.data()+str.size();
+    const auto [numberEnd, error] = std::from_chars(str.data(), end, value);
+    if (error != std::errc{} || !std::isfinite(value))
+        return false;
+    if (numberEnd == end)
+        return true;
+    Frame::Unit unit;
+    if (!Frame::unitFromStr({numberEnd, size_t(end-numberEnd)}, unit))
+        return false;
+    value *= Frame::prefixFactors[int(unit.prefix)];
+    base = unit.base;
+    return true;
+}
+
+// `NUMBER(ms|s|min)`
+bool parseDuration(std::string_view str, std::chrono::nanoseconds& out)
+{
+    const char* const end = str.data()+str.size();
+    double number;
+    const auto [numberEnd, error] = std::from_chars(str.data(), end, number);
+    if (error != std::errc{} || !(number > 0))
+        return false;
+    const std::string_view suffix{numberEnd, size_t(end-numberEnd)};
+    double factor;
+    if (suffix == "ms")
+        factor = 1e6;
+    else if (suffix == "s")
+        factor = 1e9;
+    else if (suffix == "min")
+        factor = 60e9;
+    else
+        return false;
+    out = std::chrono::nanoseconds{int64_t(number*factor)};
+    return out.count() > 0;
+}
+
+bool parseCount(std::string_view str, size_t& out)
+{
+    const char* const end = str.data()+str.size();
+    const auto [numberEnd, error] = std::from_chars(str.data(), end, out);
+    return error == std::errc{} && numberEnd == end;
+}
+
+} // namespace
+
+bool TriggerRule::fromStr(const std::string& str, TriggerRule& rule, std::string& error)
+{
+    rule = {};
+    rule.text = str;
+
+    std::string_view rest{str};
+    // Takes the next `:`-separated part as `NAME[=ARG]`
+    std::string_view name, arg;
+    bool hasArg{};
+    const auto next{[&](){
+        const size_t colon = rest.find(':');
+        const std::string_view part = rest.substr(0, colon);
+        rest = colon == std::string_view::npos ? std::string_view{} : rest.substr(colon+1);
+        const size_t equals = part.find('=');
+        name = part.substr(0, equals);
+        hasArg = equals != std::string_view::npos;
+        arg = hasArg ? part.substr(equals+1) : std::string_view{};
+    }};
+
+    next();
+    if (name == "above" || name == "below")
+    {
+        rule.condition = name == "above" ? Condition::Above : Condition::Below;
+        if (!parseValue(arg, rule.threshold, rule.base))
+        {
+            error = std::format("invalid value '{}'", arg);
+            return false;
+        }
+    }
+    else if (name == "change")
+    {
+        rule.condition = Condition::Change;
+        const size_t slash = arg.find('/');
+        if (slash == std::string_view::npos
+         || !parseValue(arg.substr(0, slash), rule.threshold, rule.base)
+         || !parseDuration(arg.substr(slash+1), rule.window))
+        {
+            error = std::format("invalid change '{}', expected VALUE/DURATION like 0.5V/100ms", arg);
+            return false;
+        }
+        rule.threshold = std::fabs(rule.threshold);
+    }
+    else if (name == "mode" && !hasArg)
+        rule.condition = Condition::Mode;
+    else if (name == "overload" && !hasArg)
+        rule.condition = Condition::Overload;
+    else
+    {
+        error = std::format("unknown condition '{}'", name);
+        return false;
+    }
+
+    while (!rest.empty())
+    {
+        if (rest.starts_with("exec="))
+        {
+            rule.command = rest.substr(5);
+            if (rule.command.empty())
+            {
+                error = "empty command";
+                return false;
+            }
+            rule.actions |= ActionCommand;
+            break;
+        }
+
+        next();
+        if (name == "mark" && !hasArg)
+            rule.actions |= ActionMark;
+        else if (name == "capture")
+        {
+            rule.actions |= ActionCapture;
+            const size_t plus = arg.find('+');
+            if (hasArg && (plus == std::string_view::npos
+                    || !parseCount(arg.substr(0, plus), rule.preSamples)
+                    || !parseCount(arg.substr(plus+1), rule.postSamples)))
+            {
+                error = std::format("invalid capture '{}', expected PRE+POST like 100+100", arg);
+                return false;
+            }
+        }
+        else
+        {
+            error = std::format("unknown action '{}'", name);
+            return false;
+        }
+    }
+    if (!rule.actions)
+        rule.actions = ActionMark;
+    return true;
+}
+
+TriggerEngine::TriggerEngine(std::vector<TriggerRule> rules, std::string captureDir)
+    : rules{std::move(rules)}, captureDir{std::move(captureDir)}
+{
+    for (const TriggerRule& rule : this->rules)
+    {
+        if (rule.actions & TriggerRule::ActionCapture)
+        {
+            maxPreSamples = std::max(maxPreSamples, rule.preSamples);
+            maxCaptureSize = std::max(maxCaptureSize, rule.preSamples+rule.postSamples);
+        }
+    }
+}
+
+TriggerEngine::~TriggerEngine()
+{
+    stop();
+}
+
+void TriggerEngine::start()
+{
+    if (!thread.joinable())
+        thread = std::thread{&TriggerEngine::threadMain, this};
+}
+
+void TriggerEngine::stop()
+{
+    {
+        const std::lock_guard<std::mutex> guard{mutex};
+        stopRequested = true;
+    }
+    cond.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+TriggerEngine::Channel& TriggerEngine::addChannel(std::string name)
+{
+    std::unique_ptr<Channel> channel{new Channel{*this, std::move(name)}};
+    const std::lock_guard<std::mutex> guard{mutex};
+    channels.push_back(std::move(channel));
+    return *channels.back();
+}
+
+void TriggerEngine::wake()
+{
+    wakeRequested.store(true, std::memory_order_relaxed);
+    cond.notify_one();
+}
+
+void TriggerEngine::threadMain()
+{
+    std::vector<Channel*> current;
+    std::vector<pid_t> children;
+    while (true)
+    {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cond.wait_for(lock, std::chrono::milliseconds{100}, [this](){
+                return stopRequested || wakeRequested.exchange(false, std::memory_order_relaxed);
+            });
+            stopping = stopRequested;
+            current.clear();
+            for (const std::unique_ptr<Channel>& channel : channels)
+                current.push_back(channel.get());
+        }
+
+        for (Channel* channel : current)
+        {
+            channel->commands.drain([&](const TriggerEvent& event){
+                const pid_t pid = runCommand(*channel, event);
+                if (pid != -1)
+                    children.push_back(pid);
+            });
+            Channel::Capture* capture;
+            while (channel->finishedCaptures.tryPop(capture))
+            {
+                writeCapture(*channel, *capture);
+                channel->freeCaptures.tryPush(capture);
+            }
+        }
+
+        // The commands run on their own, they're only reaped
+        std::erase_if(children, [](pid_t pid){ return waitpid(pid, nullptr, WNOHANG) != 0; });
+        if (stopping)
+            break;
+    }
+}
+
+void TriggerEngine::writeCapture(const Channel& channel, const Channel::Capture& capture)
+{
+    const TriggerRule& rule = rules[capture.event.rule];
+    std::error_code error;
+    std::filesystem::create_directories(captureDir, error);
+
+    // A journal is never overwritten, the captures in the same second are numbered
+    const auto seconds = std::chrono::floor<std::chrono::seconds>(capture.event.time);
+    std::string path;
+    for (int i{1}; path.empty() || std::filesystem::exists(path, error); ++i)
+        path = std::format("{}/{}-{:%Y%m%d-%H%M%S}-{}.mxj", captureDir, channel.name, seconds, i);
+
+    JournalWriter journal;
+    if (!journal.open(path))
+        return;
+    for (size_t i{}; i < capture.count; ++i)
+    {
+        journal.append(capture.records[i].bytes, capture.records[i].time);
+        // This thread can wait for the disk, so no record is dropped
+        if ((i+1) % journal::blockCapacity == 0)
+            journal.flush();
+    }
+    journal.close();
+    LOG_INFO("Trigger {} on {}: captured {} samples into {}", rule.text, channel.name, capture.count, path);
+}
+
+int TriggerEngine::runCommand(const Channel& channel, const TriggerEvent& event)
+{
+    const TriggerRule& rule = rules[event.rule];
+    char time[LocalTimeFormatter::maxSize];
+    char* const timeEnd = LocalTimeFormatter{}.format(time, event.time);
+
+    std::string variables[]{
+        "MX_TRIGGER_RULE="+rule.text,
+        "MX_TRIGGER_DEVICE="+channel.name,
+        std::format("MX_TRIGGER_VALUE={}", event.value),
+        "MX_TRIGGER_UNIT="+Frame::unitToStr(History::unpackUnit(event.flags)),
+        "MX_TRIGGER_TIME="+std::string{time, timeEnd},
+    };
+    std::vector<char*> env;
+    for (char** var = environ; *var; ++var)
+        env.push_back(*var);
+    for (std::string& var : variables)
+        env.push_back(var.data());
+    env.push_back(nullptr);
+
+    const char* argv[]{"sh", "-c", rule.command.c_str(), nullptr};
+    pid_t pid;
+    const int result = posix_spawn(&pid, "/bin/sh", nullptr, nullptr, const_cast<char**>(argv), env.data());
+    if (result != 0)
+    {
+        LOG_ERROR("Trigger {} on {}: failed to run the command: {}", rule.text, channel.name, strerror(result));
+        return -1;
+    }
+    LOG_DEBUG("Trigger {} on {}: started the command, PID {}", rule.text, channel.name, pid);
+    return pid;
+}
+
+TriggerEngine::Channel::Channel(TriggerEngine& engine, std::string name)
+    : engine{engine}, name{std::move(name)}, states(engine.rules.size()), recent(recentSize),
+      preTrigger(engine.maxPreSamples)
+{
+    for (Capture& capture : captures)
+    {
+        capture.records.resize(engine.maxCaptureSize);
+        if (engine.maxCaptureSize)
+            freeCaptures.tryPush(&capture);
+    }
+}
+
+void TriggerEngine::Channel::process(const uint8_t bytes[14], const timestamp_t& time)
+{
+    History::raw_t raw;
+    packFrame(bytes, raw);
+    const DecodedFrame decoded = decodePackedFrame(raw);
+
+    if (!preTrigger.empty())
+    {
+        Record& record = preTrigger[preTriggerCount++ % preTrigger.size()];
+        record.time = time;
+        std::copy(bytes, bytes+14, record.bytes);
+    }
+    if (capturing)
+    {
+        Record& record = capturing->records[capturing->count++];
+        record.time = time;
+        std::copy(bytes, bytes+14, record.bytes);
+        if (--postLeft == 0)
+            finishCapture();
+    }
+
+    const uint16_t mode = decoded.flags & modeMask;
+    const bool modeChanged = lastMode && *lastMode != mode;
+    lastMode = mode;
+    // A `Change` rule only compares to the samples in the current mode
+    if (modeChanged)
+        recentBegin = recentCount;
+    const size_t newest = recentCount++;
+    recent[newest % recentSize] = {time, decoded.siValue};
+    const Frame::Unit::Base base = History::unpackUnit(decoded.flags).base;
+
+    for (size_t i{}; i < engine.rules.size(); ++i)
+    {
+        const TriggerRule& rule = engine.rules[i];
+        RuleState& state = states[i];
+        const bool unitMatches = !rule.base || *rule.base == base;
+        bool matches{};
+        // An overloaded reading is NaN, it's never above or below anything
+        switch (rule.condition)
+        {
+        case TriggerRule::Condition::Above:
+            matches = unitMatches && decoded.siValue > rule.threshold;
+            break;
+        case TriggerRule::Condition::Below:
+            matches = unitMatches && decoded.siValue < rule.threshold;
+            break;
+        case TriggerRule::Condition::Change:
+            state.windowBegin = std::max({state.windowBegin, recentBegin, newest+1-std::min(newest+1, recentSize)});
+            while (state.windowBegin < newest && recent[state.windowBegin % recentSize].first < time-rule.window)
+                ++state.windowBegin;
+            matches = unitMatches && std::fabs(decoded.siValue-recent[state.windowBegin % recentSize].second) > rule.threshold;
+            break;
+        case TriggerRule::Condition::Mode:
+            matches = modeChanged;
+            break;
+        case TriggerRule::Condition::Overload:
+            matches = std::isnan(decoded.value);
+            break;
+        }
+
+        if (matches && !state.active)
+            fire(i, {.time=time, .value=decoded.value, .flags=decoded.flags, .rule=uint16_t(i)});
+        state.active = matches;
+    }
+}
+
+void TriggerEngine::Channel::fire(size_t rule, const TriggerEvent& event)
+{
+    const TriggerRule& triggerRule = engine.rules[rule];
+    LOG_LIMITED(Info, std::chrono::seconds{1}, "Trigger {} fired on {}: {} {}",
+        triggerRule.text, name, event.value, Frame::unitToStr(History::unpackUnit(event.flags)));
+
+    if (triggerRule.actions & TriggerRule::ActionMark)
+        marks.tryPush(event);
+    if (triggerRule.actions & TriggerRule::ActionCommand && commands.tryPush(event))
+        engine.wake();
+    // A capture in progress already has this sample
+    if (triggerRule.actions & TriggerRule::ActionCapture && !capturing)
+    {
+        Capture* capture;
+        if (!freeCaptures.tryPop(capture))
+        {
+            LOG_LIMITED(Warning, std::chrono::seconds{1}, "Trigger {} on {}: not captured, the previous captures are still being written",
+                triggerRule.text, name);
+            return;
+        }
+        // The pre-trigger ring already ends with this sample
+        const size_t count = std::min(preTriggerCount, triggerRule.preSamples);
+        for (size_t i{}; i < count; ++i)
+            capture->records[i] = preTrigger[(preTriggerCount-count+i) % preTrigger.size()];
+        capture->count = count;
+        capture->event = event;
+        capturing = capture;
+        postLeft = triggerRule.postSamples;
+        if (!postLeft)
+            finishCapture();
+    }
+}
+
+void TriggerEngine::Channel::finishCapture()
+{
+    // There are never more captures than fit
+    finishedCaptures.tryPush(capturing);
+    capturing = nullptr;
+    engine.wake();
+}
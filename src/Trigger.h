@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "Frame.h"
+#include "SpscRing.h"
+
+struct TriggerRule
+{
+    enum class Condition
+    {
+        Above,      // The reading rises above `threshold`
+        Below,      // The reading falls below `threshold`
+        Change,     // The reading changes by more than `threshold` within `window`
+        Mode,       // The unit or AC/DC changes
+        Overload,   // The display shows overload
+    };
+
+    enum Action : uint8_t
+    {
+        ActionMark      = 1 << 0,   // Shows the sample on the plot
+        ActionCapture   = 1 << 1,   // Writes the samples around it into a journal
+        ActionCommand   = 1 << 2,   // Runs `command`
+    };
+
+    // As it was given, for the logs
+    std::string text;
+    Condition condition{};
+    // In the base unit (V, A, Ω...)
+    double threshold{};
+    // Only the readings in this unit are compared to `threshold` when set
+    std::optional<Frame::Unit::Base> base;
+    std::chrono::nanoseconds window{std::chrono::seconds{1}};
+    uint8_t actions{};
+    // Samples up to and including the one that fired, and after it
+    size_t preSamples{100};
+    size_t postSamples{100};
+    // Run with `sh -c`, the details are in `MX_TRIGGER_*` environment variables
+    std::string command;
+
+    // Parses `CONDITION[:ACTION]...`, where the condition is `above=VALUE`,
+    // `below=VALUE`, `change=VALUE/DURATION`, `mode` or `overload`, and an
+    // action is `mark`, `capture[=PRE+POST]` or `exec=COMMAND` (which takes the
+    // rest of the string). A value may end with a unit like `11.8V` or `500mA`,
+    // a duration with `ms`, `s` or `min`. Without an action the rule marks.
+    static bool fromStr(const std::string& str, TriggerRule& rule, std::string& error);
+};
+
+// A rule fired on a sample
+struct TriggerEvent
+{
+    timestamp_t time;
+    // As shown on the display
+    float value{};
+    // `History` flags of the sample, they have the unit
+    uint16_t flags{};
+    // Index in the rules of the engine
+    uint16_t rule{};
+};
+
+/*
+ * Evaluates the trigger rules on every sample as it's read, on the I/O thread.
+ *
+ * Every device has its own `Channel` with the state of the rules. Evaluating a
+ * sample decodes it with the tables of `BatchDecoder` and never allocates,
+ * locks or waits, all the buffers are set up when the channel is added.
+ * The rules are edge-triggered, a rule fires once when its condition becomes
+ * true, and again only after it was false.
+ * Marks go to the GUI through a lock-free queue. The captures and commands
+ * are handed to the action thread of the engine, which writes the journals
+ * and starts the processes, so the I/O thread never waits for them.
+ */
+class TriggerEngine
+{
+public:
+    // Marks that can wait for the GUI, per device
+    static constexpr size_t markQueueSize = 256;
+    // Commands that can wait for the action thread, per device
+    static constexpr size_t commandQueueSize = 64;
+    // Recent samples for the `Change` rules, the window is cut to these
+    static constexpr size_t recentSize = 1024;
+    // Captures per device that can be in progress or being written, a trigger is not captured when all are busy
+    static constexpr size_t captureCount = 2;
+
+    class Channel
+    {
+    public:
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        // Called by the I/O thread for every frame
+        void process(const uint8_t bytes[14], const timestamp_t& time);
+
+        // Consumer side, the GUI thread
+        inline bool takeMark(TriggerEvent& out) { return marks.tryPop(out); }
+
+    private:
+        friend class TriggerEngine;
+
+        struct Record
+        {
+            timestamp_t time;
+            uint8_t bytes[14];
+        };
+
+        struct Capture
+        {
+            std::vector<Record> records;
+            size_t count{};
+            TriggerEvent event;
+        };
+
+        struct RuleState
+        {
+            bool active{};
+            // Absolute index in `recent` of the oldest sample in the window
+            size_t windowBegin{};
+        };
+
+        TriggerEngine& engine;
+        std::string name;
+
+        std::vector<RuleState> states;
+        std::optional<uint16_t> lastMode;
+        // Ring of the times and base unit values, only since the last change of the mode
+        std::vector<std::pair<timestamp_t, float>> recent;
+        size_t recentCount{};
+        size_t recentBegin{};
+
+        // Ring of the last samples for the captures
+        std::vector<Record> preTrigger;
+        size_t preTriggerCount{};
+        std::array<Capture, captureCount> captures;
+        Capture* capturing{};
+        size_t postLeft{};
+
+        SpscRing<TriggerEvent, markQueueSize> marks;
+        // The I/O thread produces, the action thread consumes
+        SpscRing<TriggerEvent, commandQueueSize> commands;
+        SpscRing<Capture*, captureCount> finishedCaptures;
+        // The other way around
+        SpscRing<Capture*, captureCount> freeCaptures;
+
+        Channel(TriggerEngine& engine, std::string name);
+        void fire(size_t rule, const TriggerEvent& event);
+        void finishCapture();
+    };
+
+    // The captures are written into `captureDir`
+    TriggerEngine(std::vector<TriggerRule> rules, std::string captureDir);
+    TriggerEngine(const TriggerEngine&) = delete;
+    TriggerEngine& operator=(const TriggerEngine&) = delete;
+    ~TriggerEngine();
+
+    void start();
+    // Writes the finished captures and stops the action thread, call after the I/O threads stopped
+    void stop();
+
+    // Lives as long as the engine. `name` is used in the names of the captures.
+    Channel& addChannel(std::string name);
+
+    inline const std::vector<TriggerRule>& getRules() const { return rules; }
+
+private:
+    std::vector<TriggerRule> rules;
+    std::string captureDir;
+    size_t maxPreSamples{};
+    size_t maxCaptureSize{};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::thread thread;
+    bool stopRequested{};
+    // Asks the action thread not to wait for the end of the round
+    std::atomic<bool> wakeRequested{};
+
+    void wake();
+    void threadMain();
+    void writeCapture(const Channel& channel, const Channel::Capture& capture);
+    // Returns the process ID, or -1 if it couldn't be started
+    int runCommand(const Channel& channel, const TriggerEvent& event);
+};
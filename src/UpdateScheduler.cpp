@@ -0,0 +1,41 @@
+#include "UpdateScheduler.h"
+
+UpdateScheduler::UpdateScheduler(Gtk::Widget& widget, Func wake, Func update)
+    : widget{widget}, wake{std::move(wake)}, update{std::move(update)}
+{
+    dispatcher.connect(sigc::mem_fun(*this, &UpdateScheduler::onWakeup));
+    // The tick callbacks are removed with the widget
+    widget.signal_destroy().connect([this](){ tickId = 0; });
+}
+
+UpdateScheduler::~UpdateScheduler()
+{
+    if (tickId)
+        widget.remove_tick_callback(tickId);
+}
+
+void UpdateScheduler::request()
+{
+    if (wakeupPending.exchange(true))
+        return;
+    requestTime.store(Diagnostics::clock::now(), std::memory_order_relaxed);
+    dispatcher.emit();
+}
+
+void UpdateScheduler::onWakeup()
+{
+    // Only the next request stores a new time, after the flag is cleared
+    const Diagnostics::clock::time_point requested = requestTime.load(std::memory_order_relaxed);
+    // Cleared first, so requests made while waking up are not lost
+    wakeupPending = false;
+    diagnostics.recordSince(Diagnostics::Stage::Wakeup, requested);
+    wake();
+
+    if (tickId)
+        return;
+    tickId = widget.add_tick_callback([this](const Glib::RefPtr<Gdk::FrameClock>&){
+        tickId = 0;
+        update();
+        return false;
+    });
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <glibmm/dispatcher.h>
+#include <gtkmm/widget.h>
+#include "Diagnostics.h"
+
+/*
+ * Collapses update requests into at most one update per frame.
+ *
+ * `request` may be called from any thread and any number of times.
+ * The first request wakes up the GUI thread, which calls `wake` right away
+ * (to take in the new data) and schedules `update` for the next tick of the
+ * widget's frame clock. Further requests until then only set a flag.
+ */
+class UpdateScheduler
+{
+public:
+    using Func = std::function<void()>;
+
+    // Must be created on the GUI thread
+    UpdateScheduler(Gtk::Widget& widget, Func wake, Func update);
+    ~UpdateScheduler();
+
+    void request();
+
+private:
+    Gtk::Widget& widget;
+    Func wake;
+    Func update;
+    Glib::Dispatcher dispatcher;
+    std::atomic<bool> wakeupPending{};
+    // When the pending wakeup was requested
+    std::atomic<Diagnostics::clock::time_point> requestTime{};
+    guint tickId{};
+
+    void onWakeup();
+};
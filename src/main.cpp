@@ -2,61 +2,214 @@
 #include <iostream>
 #include <iomanip>
 #include <cassert>
-#include <mutex>
 #include <stdint.h>
 #include <gtkmm.h>
 #include <gtkmm/application.h>
 #include <thread>
 #include <format>
-#include <fstream>
 #include <chrono>
+#include <bit>
+#include <array>
+#include <optional>
+#include <filesystem>
+#ifdef G_OS_UNIX
+#   include <csignal>
+#   include <glib-unix.h>
+#endif
 #include "Frame.h"
+#include "History.h"
+#include "PlotData.h"
+#include "PlotRenderer.h"
 #include "protocol.h"
+#include "DeviceMonitor.h"
+#include "UpdateScheduler.h"
+#include "CsvExporter.h"
+#include "CsvImporter.h"
+#include "Diagnostics.h"
+#include "Journal.h"
+#include "LocalTime.h"
+#include "Log.h"
+#include "Statistics.h"
+#include "MemoryBudget.h"
+#include "StreamServer.h"
+#include "Trigger.h"
+
+// Only accessed from the GUI thread, one for every device, fed by `acquisition`
+std::vector<History> histories;
+// Kept up to date with `histories`
+std::vector<StatsEngine> statistics;
+// The times of the samples marked by the triggers, one for every device
+std::vector<std::vector<timestamp_t>> triggerMarks;
+size_t selectedDevice{};
+// Outlives `acquisition`, its I/O threads evaluate the rules
+std::unique_ptr<TriggerEngine> triggers;
+// Also outlives `acquisition`, set when the readings are streamed
+std::unique_ptr<StreamServer> streamServer;
+std::unique_ptr<AcquisitionEngine> acquisition;
+
+// Whether a device is plugged in, one for every channel of `acquisition`
+struct DeviceSlot
+{
+    std::string key;
+    bool present{};
+    // Connected (or tried to) when it was unplugged, so it's connected again when it's back
+    bool reconnect{};
+};
+std::vector<DeviceSlot> deviceSlots;
+// The export in progress
+std::unique_ptr<CsvExporter> exporter;
+// The import of the file given by `--open` while it's in progress
+std::unique_ptr<CsvImporter> importer;
+
+// The oldest frame of the selected device that isn't on the screen yet
+struct UndrawnFrame
+{
+    Diagnostics::clock::time_point received;
+    // The plot request that had it, with the render thread
+    std::optional<uint64_t> generation;
+};
 
-static std::string formatTime(const timestamp_t& point)
+// What the widgets currently show
+struct DisplayedState
+{
+    size_t device{SIZE_MAX};
+    std::optional<ConnStatus> status;
+    std::array<uint64_t, 5> stats{};
+    size_t sampleCount{};
+    uint32_t valueBits{};
+    uint16_t flags{};
+};
+
+static const History& selectedHistory()
 {
-    const auto zt = std::chrono::zoned_time{std::chrono::current_zone(), point};
-    return std::format("{0:%F}T{0:%T}", zt);
+    static const History empty;
+    return selectedDevice < histories.size() ? histories[selectedDevice] : empty;
 }
 
-static void exportData(const std::string& path, const std::vector<std::unique_ptr<Frame>>& data)
+static Glib::ustring getDeviceLabel(const SerialDevice& device, bool present)
 {
-    std::ofstream file{path};
-    file << "Value;Unit;Timestamp\n";
-    for (auto& frame : data)
-    {
-        file << std::format("{};{};{}", frame->getFloatVal(), frame->getUnitStr(), formatTime(frame->timestamp)) << '\n';
-    }
-    file.close();
+    return std::format("{} {} ({}){}", device.manufacturer, device.product, device.path, present ? "" : " - unplugged");
 }
 
-std::vector<std::unique_ptr<Frame>> frames;
-std::mutex framesMutex{};
+// The device node may not be usable right when it appears, udev sets up its permissions a moment later
+static void connectPluggedDevice(size_t channel)
+{
+    acquisition->connect(channel);
+    Glib::signal_timeout().connect([channel, retries=3]() mutable {
+        if (!acquisition || !deviceSlots[channel].present
+                || acquisition->getChannel(channel).status != ConnStatus::FailedToOpen)
+            return false;
+        LOG_DEBUG("Retrying to connect to {}", acquisition->getChannel(channel).device.path);
+        acquisition->connect(channel);
+        return --retries > 0;
+    }, 1000);
+}
 
 int main(int argc, char** argv)
 {
     Gtk::Window* mainWindow{};
     Glib::RefPtr<Gtk::Builder> builder{};
-    ConnStatus connStatus = ConnStatus::Closed;
-    Glib::Dispatcher dispatcher{};
-    int plotGap = 20;
+    std::unique_ptr<UpdateScheduler> guiUpdates{};
+    Glib::Dispatcher plotReadyDispatcher{};
+    Glib::Dispatcher exportDispatcher{};
+    Glib::Dispatcher importDispatcher{};
+    Glib::Dispatcher deviceDispatcher{};
+    std::unique_ptr<DeviceMonitor> deviceMonitor{};
+    Glib::RefPtr<Gtk::StringList> deviceList{};
+    std::shared_ptr<PlotRenderer> plotRenderer{};
+    bool threadedPlot{};
+    int ioThreadCount = 1;
+    std::string recordDir;
+    std::string replayPath;
+    int memoryBudgetMib = 512;
+    std::string spillDir;
+    std::string logLevel;
+    std::vector<Glib::ustring> triggerTexts;
+    std::vector<TriggerRule> triggerRules;
+    std::string captureDir;
+    std::string streamSocket;
+    int streamPort{};
+    std::vector<Glib::ustring> statsWindowTexts;
+    // The trailing windows of the statistics of every device
+    std::vector<std::chrono::nanoseconds> statsWindows{std::begin(StatsEngine::defaultWindows), std::end(StatsEngine::defaultWindows)};
+    std::unique_ptr<MemoryBudget> memoryBudget;
+    PlotView plotView;
+    // The view when the drag that pans it started
+    PlotView panStartView;
+    // The time range [first, second) selected for the export
+    std::optional<std::pair<timestamp_t, timestamp_t>> plotSelection;
     std::optional<int> canvasMouseX{};
     std::optional<int> canvasMouseY{};
-
-    std::atomic<bool> keepThreadAlive = true;
-    std::atomic<bool> stayConnected = true;
-
-    std::thread connThread{[](){}};
-    static const auto startThread{[&](const SerialDevice& device){
-        connThread.join();
-        connThread = std::thread{&startReadingData,
-            std::ref(keepThreadAlive), std::ref(stayConnected), std::ref(connStatus),
-            std::ref(frames), std::ref(framesMutex), std::ref(dispatcher), device};
-        keepThreadAlive = true;
-        stayConnected = true;
-    }};
+    std::optional<UndrawnFrame> undrawnFrame;
+    sigc::connection diagnosticsRefresh;
 
     auto app = Gtk::Application::create("xyz.timre13.mx-ui");
+    app->add_main_option_entry(Gio::Application::OptionType::BOOL, "threaded-plot", 't', "Render the plot on a separate thread");
+    app->add_main_option_entry(Gio::Application::OptionType::INT, "io-threads", 'j', "Number of threads reading the devices", "N");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "record", 'r', "Record the frames of every device into a journal in DIR", "DIR");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "open", 'o', "Show a recorded journal or an exported CSV instead of the devices", "FILE");
+    app->add_main_option_entry(Gio::Application::OptionType::INT, "memory-budget", 'm', "RAM for the samples in MiB, older ones go to the disk (default: 512, 0: no limit)", "MIB");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "spill-dir", '\0', "Where the samples over the memory budget go (default: the user cache directory)", "DIR");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "log-level", 'l', "Least severe messages to log: trace, debug, info, warning or error (default: info)", "LEVEL");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING_VECTOR, "trigger", '\0', "Evaluate RULE on every sample of the devices, like below=11.8V:mark:capture or change=2V/100ms:exec=COMMAND (repeatable)", "RULE");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "capture-dir", '\0', "Where the triggers write their captures (default: the user data directory)", "DIR");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING, "stream-socket", '\0', "Stream the live readings as lines of text to the clients of a Unix socket at PATH", "PATH");
+    app->add_main_option_entry(Gio::Application::OptionType::INT, "stream-port", '\0', "Stream the live readings to the TCP clients of PORT on 127.0.0.1", "PORT");
+    app->add_main_option_entry(Gio::Application::OptionType::STRING_VECTOR, "stats-window", '\0', "Also show the statistics of the last LENGTH, like 30s, 5min or 1h, instead of 10s, 1min and 1h (repeatable)", "LENGTH");
+    app->signal_handle_local_options().connect([&](const Glib::RefPtr<Glib::VariantDict>& options){
+        threadedPlot = options->contains("threaded-plot");
+        options->lookup_value("io-threads", ioThreadCount);
+        options->lookup_value("record", recordDir);
+        options->lookup_value("open", replayPath);
+        options->lookup_value("memory-budget", memoryBudgetMib);
+        options->lookup_value("spill-dir", spillDir);
+        options->lookup_value("log-level", logLevel);
+        options->lookup_value("trigger", triggerTexts);
+        options->lookup_value("capture-dir", captureDir);
+        options->lookup_value("stream-socket", streamSocket);
+        options->lookup_value("stream-port", streamPort);
+        options->lookup_value("stats-window", statsWindowTexts);
+        if (streamPort < 0 || streamPort > UINT16_MAX)
+        {
+            std::cerr << "Invalid stream port: " << streamPort << '\n';
+            return 1;
+        }
+        if (!logLevel.empty())
+        {
+            LogLevel level;
+            if (!Logger::levelFromStr(logLevel, level))
+            {
+                std::cerr << "Unknown log level: " << logLevel << '\n';
+                return 1;
+            }
+            logger.setLevel(level);
+        }
+        for (const Glib::ustring& text : triggerTexts)
+        {
+            TriggerRule rule;
+            std::string error;
+            if (!TriggerRule::fromStr(text, rule, error))
+            {
+                std::cerr << "Invalid trigger " << text << ": " << error << '\n';
+                return 1;
+            }
+            triggerRules.push_back(std::move(rule));
+        }
+        if (!statsWindowTexts.empty())
+            statsWindows.clear();
+        for (const Glib::ustring& text : statsWindowTexts)
+        {
+            std::chrono::nanoseconds length;
+            if (!StatsEngine::lengthFromStr(text.raw(), length))
+            {
+                std::cerr << "Invalid statistics window: " << text << '\n';
+                return 1;
+            }
+            statsWindows.push_back(length);
+        }
+        return -1;
+    }, false);
+
     app->signal_activate().connect([&](){
         builder = Gtk::Builder::create_from_resource("/data/main.ui");
         mainWindow = builder->get_widget<Gtk::Window>("main-window");
@@ -66,132 +219,486 @@ int main(int argc, char** argv)
         cssProv->load_from_resource("/data/style.css");
         Gtk::StyleContext::add_provider_for_display(mainWindow->get_display(), cssProv, GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
 
-        builder->get_widget<Gtk::Button>("connect-button")->signal_clicked().connect([&](){
-            std::cout << "Clicked\n";
-            stayConnected = !stayConnected;
-        });
+        memoryBudget = std::make_unique<MemoryBudget>(size_t(std::max(memoryBudgetMib, 0))*1024*1024,
+                spillDir.empty() ? Glib::get_user_cache_dir()+"/mx-ui" : spillDir);
 
-        {
-            const auto devs = listSerialDevices();
-            if (devs.empty())
+        // Takes in the new frames of all the devices
+        const auto ingestFrames{[&memoryBudget, &undrawnFrame](){
+            if (!acquisition)
+                return;
+            const Diagnostics::ScopeTimer timer{Diagnostics::Stage::Ingest};
+            for (size_t i{}; i < acquisition->getChannelCount(); ++i)
             {
-                std::cout << "No serial devices found\n";
+                IngestQueue& ingest = acquisition->getChannel(i).ingest;
+                ingest.wakeupPending = false;
+                if (ingest.ring.drain([i, &undrawnFrame](const RawFrame& frame){
+                    diagnostics.recordSince(Diagnostics::Stage::Queue, frame.received);
+                    if (i == selectedDevice && !undrawnFrame)
+                        undrawnFrame = UndrawnFrame{.received = frame.received};
+                    histories[i].append(frame.bytes, frame.timestamp);
+                }))
+                    statistics[i].update(histories[i]);
+                if (TriggerEngine::Channel* channelTriggers = acquisition->getChannel(i).triggers)
+                {
+                    TriggerEvent event;
+                    while (channelTriggers->takeMark(event))
+                        triggerMarks[i].push_back(event.time);
+                }
             }
-            else
+            memoryBudget->enforce(histories);
+        }};
+
+        // Brings the widgets up to date with the selected device, only touching what changed
+        const auto updateGui{[&builder, displayed=DisplayedState{}]() mutable {
+            if (histories.empty())
+                return;
+            const Diagnostics::ScopeTimer timer{Diagnostics::Stage::Update};
+
+            const bool deviceChanged = displayed.device != selectedDevice;
+            displayed.device = selectedDevice;
+
+            // Replayed journals have no channel
+            if (acquisition && selectedDevice < acquisition->getChannelCount())
             {
-                std::cout << "Enumerating serial devices:\n";
-                for (const auto& file : devs)
+                const AcquisitionEngine::Channel& channel = acquisition->getChannel(selectedDevice);
+
+                const ConnStatus connStatus = channel.status;
+                if (deviceChanged || connStatus != displayed.status)
                 {
-                    std::cout << '\t' << file.manufacturer << ' ' << file.product << " = " << file.path << std::endl;
+                    builder->get_widget<Gtk::Label>("status-display")->set_markup(std::format(
+                            "<span foreground='{}'>{}</span>", connStatusGetColor(connStatus), connStatusToStr(connStatus)));
+                    builder->get_widget<Gtk::Button>("connect-button")->set_label(
+                            connStatus == ConnStatus::Connected ? "DISCONNECT" : "CONNECT");
+                    displayed.status = connStatus;
                 }
 
-                std::vector<Glib::ustring> devStrings;
-                std::transform(devs.begin(), devs.end(), std::back_inserter(devStrings), [](const SerialDevice& x){
-                        return std::format("{} {} ({})", x.manufacturer, x.product, x.path);
-                });
-                auto list = Gtk::StringList::create(devStrings);
-
-                auto dropdown = builder->get_widget<Gtk::DropDown>("port-dropdown");
-                dropdown->set_model(list);
-
-                dropdown->property_selected().signal_changed().connect([&keepThreadAlive, &stayConnected, &builder, devs](){
-                    keepThreadAlive = false;
-                    stayConnected = false;
-                    const auto selected = builder->get_widget<Gtk::DropDown>("port-dropdown")->get_selected();
-                    const auto device = devs[selected];
-                    std::cout << "Selected device: " << device.path << '\n';
-                    startThread(device);
-                });
+                const DecoderStats& decStats = channel.ingest.decoderStats;
+                const std::array<uint64_t, 5> stats{
+                    decStats.frames, channel.ingest.ring.getDropCount(), decStats.droppedBytes,
+                    decStats.badDigits, decStats.resyncs};
+                if (deviceChanged || stats != displayed.stats)
+                {
+                    builder->get_widget<Gtk::Label>("status-display")->set_tooltip_text(std::format(
+                            "Status\nFrames: {}\nDropped frames: {}\nDropped bytes: {}\nBad digits: {}\nResyncs: {}",
+                            stats[0], stats[1], stats[2], stats[3], stats[4]));
+                    displayed.stats = stats;
+                }
+            }
 
-                // Connect to the first serial device that we could find
-                startThread(devs[0]);
+            const History& history = selectedHistory();
+            if (!deviceChanged && history.size() == displayed.sampleCount)
+                return;
+            // After an empty history, the reading shown isn't of this device
+            const bool showAll = deviceChanged || displayed.sampleCount == 0;
+            displayed.sampleCount = history.size();
+            builder->get_widget<Gtk::DrawingArea>("plot-area")->queue_draw();
+
+            static constexpr std::pair<const char*, History::Flag> statusLabels[]{
+                {"auto", History::FlagAuto},
+                {"dc", History::FlagDC},
+                {"ac", History::FlagAC},
+                {"diode", History::FlagDiode},
+                {"beep", History::FlagBeep},
+                {"hold", History::FlagHold},
+                {"rel", History::FlagRel},
+                {"batt", History::FlagBattery},
+            };
+            if (history.empty())
+            {
+                // A device that has no readings yet shows none, not those of the previous one
+                if (deviceChanged)
+                {
+                    builder->get_widget<Gtk::Label>("stats-display")->set_label("");
+                    builder->get_widget<Gtk::Label>("lcd-display-1")->set_label("");
+                    builder->get_widget<Gtk::Label>("lcd-display-2")->set_label("");
+                    for (const auto& [id, flag] : statusLabels)
+                        builder->get_widget<Gtk::Label>(std::string{"status-label-"}+id)->remove_css_class("status-label-active");
+                }
+                return;
             }
-        }
 
+            builder->get_widget<Gtk::Label>("stats-display")->set_label(statistics[selectedDevice].formatTable(history));
 
-        auto drawingArea = builder->get_widget<Gtk::DrawingArea>("plot-area");
-        assert(drawingArea);
-        drawingArea->set_draw_func([drawingArea, &plotGap, &canvasMouseX, &canvasMouseY](const Cairo::RefPtr<Cairo::Context>& cont, int width, int height){
-            //std::cout << "Redrawing: w = " << width << ", h = " << height << '\n';
-            //std::cout << "Gap: " << plotGap << '\n';
-            //std::cout << "frames.size(): " << frames.size() << '\n';
+            const size_t last = history.size()-1;
+            const float val = history.getValue(last);
+            const uint16_t flags = history.getFlags(last);
+            if (showAll || std::bit_cast<uint32_t>(val) != displayed.valueBits)
+            {
+                const auto strVal = std::isnan(val) ? "-------" : std::format("{:^ 3.3f}", val);
+                builder->get_widget<Gtk::Label>("lcd-display-1")->set_label(strVal);
+                displayed.valueBits = std::bit_cast<uint32_t>(val);
+            }
 
-            auto styleCont = drawingArea->get_style_context();
-            styleCont->render_background(cont, 0, 0, width, height);
+            const uint16_t unitMask = History::unitFieldMask << History::unitPrefixShift | History::unitFieldMask << History::unitBaseShift;
+            const uint16_t changedFlags = showAll ? 0xffff : flags ^ displayed.flags;
+            if (changedFlags & unitMask)
+                builder->get_widget<Gtk::Label>("lcd-display-2")->set_label(history.getUnitStr(last));
 
-            const double middleY = height/2.;
+            for (const auto& [id, flag] : statusLabels)
+            {
+                if (!(changedFlags & flag))
+                    continue;
+                auto widget = builder->get_widget<Gtk::Label>(std::string{"status-label-"}+id);
+                if (flags & flag) widget->add_css_class("status-label-active");
+                else widget->remove_css_class("status-label-active");
+            }
+            displayed.flags = flags;
+        }};
 
+        guiUpdates = std::make_unique<UpdateScheduler>(*mainWindow, ingestFrames, updateGui);
+
+        builder->get_widget<Gtk::Button>("connect-button")->signal_clicked().connect([&](){
+            LOG_DEBUG("Connect button clicked");
+            if (acquisition && selectedDevice < acquisition->getChannelCount())
+            {
+                DeviceSlot& slot = deviceSlots[selectedDevice];
+                const ConnStatus status = acquisition->getChannel(selectedDevice).status;
+                if (status == ConnStatus::Connected || status == ConnStatus::Connecting)
+                {
+                    acquisition->disconnect(selectedDevice);
+                    slot.reconnect = false;
+                }
+                else if (slot.present)
+                    acquisition->connect(selectedDevice);
+                else
+                    // Connects when it's plugged back in
+                    slot.reconnect = true;
+            }
+        });
+
+        if (!replayPath.empty() && std::filesystem::path{replayPath}.extension() == ".csv")
+        {
+            importer = std::make_unique<CsvImporter>([&importDispatcher](){ importDispatcher.emit(); });
+            if (importer->open(replayPath))
             {
-                cont->set_source_rgba(0.1, 0.1, 0.1, 0.8);
-                cont->set_line_width(0.5);
-                for (int i{}; i < width/10; i++)
+                LOG_INFO("Importing {} MiB from {}", importer->getSize()/(1024*1024), replayPath);
+                builder->get_widget<Gtk::DropDown>("port-dropdown")->set_model(
+                        Gtk::StringList::create({std::format("Import ({})", replayPath)}));
+                histories.resize(1);
+                statistics.emplace_back(statsWindows);
+
+                // The rows are parsed on all the cores, and appended here in the order of the file as the pieces are done.
+                // Like the replay, they're appended while idle, for a budget of time per call, so the window keeps
+                // drawing. A piece is taken by parts, and the rest is appended by the next call.
+                struct ImportState
                 {
-                    if (i % 2)
+                    CsvImporter::Batch batch;
+                    // Rows of the batch appended so far
+                    size_t appended{};
+                    sigc::connection idle;
+                };
+                auto state = std::make_shared<ImportState>();
+                auto appendImported = [state, &builder, &guiUpdates, &memoryBudget](){
+                    constexpr size_t rowStep = 1 << 14;
+                    constexpr std::chrono::milliseconds timeBudget{5};
+                    if (!importer)
+                        return false;
+
+                    const auto start = std::chrono::steady_clock::now();
+                    bool appended{};
+                    bool budgetUsed{};
+                    while (true)
                     {
-                        cont->move_to(i*10, middleY);
-                        cont->line_to((i+1)*10, middleY);
+                        if (state->appended == state->batch.size())
+                        {
+                            if (!importer->takeBatch(state->batch))
+                                break;
+                            state->appended = 0;
+                            continue;
+                        }
+                        if (std::chrono::steady_clock::now()-start >= timeBudget)
+                        {
+                            budgetUsed = true;
+                            break;
+                        }
+                        const size_t count = std::min(rowStep, state->batch.size()-state->appended);
+                        histories[0].append(state->batch.frames.data()+state->appended*14, 14,
+                                state->batch.timestamps.data()+state->appended, count);
+                        state->appended += count;
+                        appended = true;
                     }
-                }
-                cont->stroke();
+                    if (appended)
+                    {
+                        statistics[0].update(histories[0]);
+                        memoryBudget->enforce(histories);
+                        guiUpdates->request();
+                    }
+
+                    auto status = builder->get_widget<Gtk::Label>("status-display");
+                    if (budgetUsed || !importer->isFinished())
+                    {
+                        status->set_markup(std::format("<span foreground='gray'>Import {}%</span>",
+                                importer->getSize() ? importer->getBytesTaken()*100/importer->getSize() : 0));
+                        // Otherwise the dispatcher brings it back when the next piece is parsed
+                        return budgetUsed;
+                    }
+                    LOG_INFO("Imported {} rows from {}", importer->getRowCount(), importer->getPath());
+                    if (importer->getSkippedLines())
+                        LOG_WARNING("Skipped {} lines of {} that aren't rows of an export", importer->getSkippedLines(), importer->getPath());
+                    status->set_markup("<span foreground='gray'>Imported</span>");
+                    importer.reset();
+                    state->batch = {};
+                    return false;
+                };
+                importDispatcher.connect([state, appendImported](){
+                    if (!state->idle.connected())
+                        state->idle = Glib::signal_idle().connect(appendImported);
+                });
+                // An empty file has no pieces to be done
+                importDispatcher.emit();
             }
+        }
+        else if (!replayPath.empty())
+        {
+            auto reader = std::make_shared<JournalReader>();
+            if (reader->open(replayPath))
+            {
+                LOG_INFO("Replaying {} frames from {}", reader->size(), replayPath);
+                builder->get_widget<Gtk::DropDown>("port-dropdown")->set_model(
+                        Gtk::StringList::create({std::format("Journal ({})", replayPath)}));
+                builder->get_widget<Gtk::Label>("status-display")->set_markup("<span foreground='gray'>Replay</span>");
+                histories.resize(1);
+                statistics.emplace_back(statsWindows);
+
+                // The records are decoded while idle, so the window comes up right away. Every idle call
+                // takes a budget of records or time, and updates the statistics and the memory once.
+                Glib::signal_idle().connect([reader, &guiUpdates, &memoryBudget, block=size_t{}, timestamps=std::vector<timestamp_t>{}]() mutable {
+                    constexpr size_t recordBudget = 1 << 16;
+                    constexpr std::chrono::milliseconds timeBudget{5};
+                    if (block == reader->getBlockCount())
+                        return false;
+
+                    const auto start = std::chrono::steady_clock::now();
+                    size_t decoded{};
+                    do
+                    {
+                        if (reader->verifyBlock(block))
+                        {
+                            const JournalReader::Block& info = reader->getBlock(block);
+                            timestamps.resize(info.count);
+                            for (size_t i{}; i < info.count; ++i)
+                                timestamps[i] = reader->getTimestamp(info.first+i);
+                            // The records of a block are next to each other
+                            histories[0].append(reader->getBytes(info.first), journal::recordSize, timestamps.data(), info.count);
+                            decoded += info.count;
+                        }
+                        else
+                        {
+                            LOG_LIMITED(Warning, std::chrono::seconds{1}, "Skipping corrupted journal block {}", block);
+                        }
+                        ++block;
+                    }
+                    while (block < reader->getBlockCount() && decoded < recordBudget
+                        && std::chrono::steady_clock::now()-start < timeBudget);
 
-            if (!frames.empty())
+                    if (decoded)
+                    {
+                        statistics[0].update(histories[0]);
+                        memoryBudget->enforce(histories);
+                    }
+                    guiUpdates->request();
+                    return true;
+                });
+            }
+        }
+        else
+        {
+            deviceList = Gtk::StringList::create({});
+            auto dropdown = builder->get_widget<Gtk::DropDown>("port-dropdown");
+            dropdown->set_model(deviceList);
+            dropdown->property_selected().signal_changed().connect([&guiUpdates, &builder](){
+                selectedDevice = builder->get_widget<Gtk::DropDown>("port-dropdown")->get_selected();
+                if (selectedDevice < acquisition->getChannelCount())
+                    LOG_DEBUG("Selected device: {}", acquisition->getChannel(selectedDevice).device.path);
+                guiUpdates->request();
+            });
+
+            if (!triggerRules.empty())
+            {
+                triggers = std::make_unique<TriggerEngine>(std::move(triggerRules),
+                        captureDir.empty() ? Glib::get_user_data_dir()+"/mx-ui/captures" : captureDir);
+                triggers->start();
+            }
+            if (!streamSocket.empty() || streamPort)
             {
-                std::lock_guard<std::mutex> guard = std::lock_guard{framesMutex};
+                streamServer = std::make_unique<StreamServer>();
+                if (!streamServer->start(streamSocket, uint16_t(streamPort)))
+                    streamServer.reset();
+            }
 
-                cont->set_line_width(1);
-                cont->set_source_rgb(0.3, 1.0, 0.8);
-                cont->move_to(0, middleY);
-                const int framesToDraw = std::min((int)width/plotGap, (int)frames.size());
-                int maxDiff{};
+            // Starts with no devices, they're added as the monitor finds them, so the window comes up right away
+            acquisition = std::make_unique<AcquisitionEngine>([&guiUpdates](){ guiUpdates->request(); }, ioThreadCount);
+            acquisition->start();
+
+            deviceDispatcher.connect([&deviceMonitor, &deviceList, &builder, &guiUpdates, &recordDir, &statsWindows](){
+                const auto relabel{[&](size_t i){
+                    // Replacing the item would move the selection
+                    auto dropdown = builder->get_widget<Gtk::DropDown>("port-dropdown");
+                    const guint selected = dropdown->get_selected();
+                    deviceList->splice(i, 1, {getDeviceLabel(acquisition->getChannel(i).device, deviceSlots[i].present)});
+                    dropdown->set_selected(selected);
+                }};
+
+                for (const DeviceEvent& event : deviceMonitor->takeEvents())
+                {
+                    const std::string key = event.device.getKey();
+                    const size_t i = std::find_if(deviceSlots.begin(), deviceSlots.end(),
+                            [&key](const DeviceSlot& slot){ return slot.key == key; })-deviceSlots.begin();
+
+                    if (event.type == DeviceEvent::Type::Removed)
+                    {
+                        if (i == deviceSlots.size())
+                            continue;
+                        DeviceSlot& slot = deviceSlots[i];
+                        // By now the read has most likely failed, only a closed one was disconnected by the user
+                        const ConnStatus status = acquisition->getChannel(i).status;
+                        slot.present = false;
+                        slot.reconnect = status != ConnStatus::Closed;
+                        if (status == ConnStatus::Connected || status == ConnStatus::Connecting)
+                            acquisition->disconnect(i);
+                        relabel(i);
+                        continue;
+                    }
+
+                    if (i < deviceSlots.size())
+                    {
+                        // Plugged back in, maybe into another port
+                        DeviceSlot& slot = deviceSlots[i];
+                        if (acquisition->getChannel(i).device.path != event.device.path)
+                            acquisition->switchDevice(i, event.device);
+                        slot.present = true;
+                        relabel(i);
+                        if (slot.reconnect)
+                        {
+                            LOG_INFO("Reconnecting to {}", event.device.path);
+                            slot.reconnect = false;
+                            connectPluggedDevice(i);
+                        }
+                        continue;
+                    }
+
+                    const std::string name = std::filesystem::path{event.device.path}.filename().string();
+                    std::unique_ptr<JournalWriter> journal;
+                    if (!recordDir.empty())
+                    {
+                        const auto startTime = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+                        const std::filesystem::path path = std::filesystem::path{recordDir}
+                            / std::format("{}-{:%Y%m%d-%H%M%S}.mxj", name, startTime);
+                        journal = std::make_unique<JournalWriter>();
+                        if (journal->open(path))
+                            LOG_INFO("Recording {} to {}", event.device.path, path.string());
+                        else
+                            journal.reset();
+                    }
+                    const size_t channel = acquisition->addChannel(event.device, std::move(journal),
+                            triggers ? &triggers->addChannel(name) : nullptr,
+                            streamServer ? &streamServer->addChannel(name) : nullptr);
+                    assert(channel == histories.size());
+                    histories.emplace_back();
+                    statistics.emplace_back(statsWindows);
+                    triggerMarks.emplace_back();
+                    deviceSlots.push_back({.key=key, .present=true, .reconnect=false});
+                    deviceList->append(getDeviceLabel(event.device, true));
+                    // Every device that shows up is read
+                    connectPluggedDevice(channel);
+                }
+                guiUpdates->request();
+            });
+            deviceMonitor = std::make_unique<DeviceMonitor>([&deviceDispatcher](){ deviceDispatcher.emit(); });
+            deviceMonitor->start();
+        }
+
+
+        auto drawingArea = builder->get_widget<Gtk::DrawingArea>("plot-area");
+        assert(drawingArea);
+        plotRenderer = std::make_shared<PlotRenderer>([drawingArea](const Cairo::RefPtr<Cairo::Context>& cont, int width, int height){
+            drawingArea->get_style_context()->render_background(cont, 0, 0, width, height);
+        });
+        if (threadedPlot)
+        {
+            LOG_INFO("Rendering the plot on a separate thread");
+            plotReadyDispatcher.connect([drawingArea](){ drawingArea->queue_draw(); });
+            plotRenderer->startThread([&plotReadyDispatcher](){ plotReadyDispatcher.emit(); });
+        }
+        drawingArea->set_draw_func([plotRenderer, &plotView, &plotSelection, &canvasMouseX, &canvasMouseY, &undrawnFrame,
+                timeFormatter=LocalTimeFormatter{}](const Cairo::RefPtr<Cairo::Context>& cont, int width, int height) mutable {
+            const Diagnostics::ScopeTimer timer{Diagnostics::Stage::Draw};
+            diagnostics.countRedraw();
+            LOG_TRACE("Redrawing: w = {}, h = {}", width, height);
+            LOG_TRACE("Pixel duration: {}", plotView.getPixelDuration());
+            const History& history = selectedHistory();
+            LOG_TRACE("history.size(): {}", history.size());
+
+            plotRenderer->draw(cont, history, width, height, plotView);
+
+            // With the render thread, the frame is only on the screen when the trace requested with it is done
+            if (undrawnFrame.has_value())
+            {
+                if (!undrawnFrame->generation)
+                    undrawnFrame->generation = plotRenderer->getRequestedGeneration();
+                if (*undrawnFrame->generation <= plotRenderer->getCompletedGeneration())
                 {
-                    float maxVal = frames[0]->getFloatValOrZero();
-                    for (size_t i=frames.size()-framesToDraw; i < frames.size(); ++i)
-                        if (frames[i]->getFloatValOrZero() > maxVal)
-                            maxVal = frames[i]->getFloatValOrZero();
-                    float minVal = frames[0]->getFloatValOrZero();
-                    for (size_t i=frames.size()-framesToDraw; i < frames.size(); ++i)
-                        if (frames[i]->getFloatValOrZero() < minVal)
-                            minVal = frames[i]->getFloatValOrZero();
-                    maxDiff = std::max(maxVal, std::abs(minVal));
+                    diagnostics.recordSince(Diagnostics::Stage::EndToEnd, undrawnFrame->received);
+                    undrawnFrame.reset();
                 }
-                //std::cout << "framesToDraw = "  << framesToDraw << std::endl;
-                for (int i{}; i < framesToDraw; ++i)
+            }
+
+            // The selection, the trigger marks and the hover cursor are overlays, they don't touch the trace
+            if (selectedDevice < triggerMarks.size() && !triggerMarks[selectedDevice].empty())
+            {
+                const std::vector<timestamp_t>& marks = triggerMarks[selectedDevice];
+                const int64_t lastBucket = plotView.getLastBucket(history);
+                const timestamp_t firstVisible = plotView.getBucketStart(PlotView::xToBucket(0, lastBucket, width));
+                cont->set_line_width(1);
+                cont->set_source_rgba(1.0, 0.6, 0.1, 0.8);
+                for (auto it = std::lower_bound(marks.begin(), marks.end(), firstVisible); it != marks.end(); ++it)
                 {
-                    const double diff = frames[frames.size()-framesToDraw+i]->getFloatValOrZero()/maxDiff*(middleY-10);
-                    const int x = width-framesToDraw*plotGap+(i+1)*plotGap;
-                    const int y = middleY-(std::isnan(diff) || std::isinf(diff) ? 0 : diff);
-                    //std::cout << i << '\t' << x << '\t' << y << '\n';
-                    if (i == 0)
-                        cont->move_to(x, y);
-                    cont->line_to(x, y);
+                    const int x = PlotView::bucketToX(plotView.getBucket(*it), lastBucket, width);
+                    if (x >= width)
+                        break;
+                    cont->move_to(x, 0);
+                    cont->line_to(x, height);
                 }
                 cont->stroke();
+            }
 
-                if (canvasMouseX.has_value())
+            if (plotSelection.has_value())
+            {
+                const int64_t lastBucket = plotView.getLastBucket(history);
+                const int x1 = PlotView::bucketToX(plotView.getBucket(plotSelection->first), lastBucket, width);
+                const int x2 = PlotView::bucketToX(plotView.getBucket(plotSelection->second), lastBucket, width);
+                cont->set_source_rgba(0.3, 0.5, 1.0, 0.25);
+                cont->rectangle(x1, 0, x2-x1, height);
+                cont->fill();
+            }
+
+            if (canvasMouseX.has_value())
+            {
+                if (const auto hover = findPlotHover(history, width, plotView, *canvasMouseX))
                 {
-                    const int endOffs = (width-*canvasMouseX+plotGap/2)/plotGap;
-                    if (endOffs < (int)frames.size())
-                    {
-                        cont->set_source_rgb(0.2, 0.8, 0.8);
-                        cont->move_to(width-endOffs*plotGap, 0);
-                        cont->line_to(width-endOffs*plotGap, height);
-                        cont->stroke();
-
-                        const Frame* const hoveredFrame = frames[frames.size()-1-endOffs].get();
-                        std::cout << "Value: " << hoveredFrame->getFloatVal() << std::endl;
-                        cont->set_source_rgb(1.0, 1.0, 1.0);
-                        cont->select_font_face("monoscape", Cairo::ToyFontFace::Slant::NORMAL, Cairo::ToyFontFace::Weight::NORMAL);
-                        cont->set_font_size(18);
-                        Cairo::TextExtents extends;
-                        const std::string text = std::format("Value: {:^ 3.3f} {}", hoveredFrame->getFloatVal(), hoveredFrame->getUnitStr());
-                        cont->get_text_extents(text, extends);
-                        assert(canvasMouseY.has_value());
-                        const int textX = std::min(*canvasMouseX+5, width-(int)extends.width-5);
-                        const int textY = std::max(*canvasMouseY-5, 15);
-                        cont->move_to(textX, textY);
-                        cont->show_text(text);
-                    }
+                    cont->set_line_width(1);
+                    cont->set_source_rgb(0.2, 0.8, 0.8);
+                    cont->move_to(hover->x, 0);
+                    cont->line_to(hover->x, height);
+                    cont->stroke();
+
+                    const size_t hoveredI = hover->sample;
+                    LOG_TRACE("Value: {}", history.getValue(hoveredI));
+                    cont->set_source_rgb(1.0, 1.0, 1.0);
+                    cont->select_font_face("monoscape", Cairo::ToyFontFace::Slant::NORMAL, Cairo::ToyFontFace::Weight::NORMAL);
+                    cont->set_font_size(18);
+                    Cairo::TextExtents extends;
+                    // `HH:MM:SS.fff` out of the full timestamp
+                    char timeStr[LocalTimeFormatter::maxSize];
+                    timeFormatter.format(timeStr, history.getTimestamp(hoveredI));
+                    const std::string text = std::format("Value: {:^ 3.3f} {} at {}", history.getValue(hoveredI), history.getUnitStr(hoveredI),
+                            std::string_view{timeStr+11, 12});
+                    cont->get_text_extents(text, extends);
+                    assert(canvasMouseY.has_value());
+                    const int textX = std::min(*canvasMouseX+5, width-(int)extends.width-5);
+                    const int textY = std::max(*canvasMouseY-5, 15);
+                    cont->move_to(textX, textY);
+                    cont->show_text(text);
                 }
             }
         });
@@ -200,20 +707,64 @@ int main(int argc, char** argv)
         auto drawingAreaScrollController = Gtk::EventControllerScroll::create();
         drawingArea->add_controller(drawingAreaScrollController);
         drawingAreaScrollController->set_flags(Gtk::EventControllerScroll::Flags::VERTICAL);
-        drawingAreaScrollController->signal_scroll().connect([&plotGap, builder](double, double scroll){
-            //std::cout << "Scroll: " << scroll << '\n';
-            plotGap -= scroll;
-            plotGap = std::max(1, plotGap);
+        // Touchpads scroll by fractions of a step, those add up until they make whole steps
+        drawingAreaScrollController->signal_scroll().connect([&plotView, builder, scrollRest=0.0](double, double scroll) mutable {
+            LOG_TRACE("Scroll: {}", scroll);
+            scrollRest += scroll;
+            const int steps = int(scrollRest);
+            if (!steps)
+                return true;
+            scrollRest -= steps;
+            plotView.zoom(steps);
             auto drawingArea = builder->get_widget<Gtk::DrawingArea>("plot-area");
             assert(drawingArea);
             drawingArea->queue_draw();
             return true;
         }, false);
 
+        // Dragging with the left button pans, back past the newest sample it follows the new samples again
+        auto drawingAreaPanGesture = Gtk::GestureDrag::create();
+        drawingArea->add_controller(drawingAreaPanGesture);
+        drawingAreaPanGesture->set_button(GDK_BUTTON_PRIMARY);
+        drawingAreaPanGesture->signal_drag_begin().connect([&plotView, &panStartView](double, double){
+            panStartView = plotView;
+        });
+        drawingAreaPanGesture->signal_drag_update().connect([&plotView, &panStartView, drawingArea](double offsetX, double){
+            plotView = panStartView;
+            plotView.pan(selectedHistory(), (int)offsetX);
+            drawingArea->queue_draw();
+        });
+
+        // Dragging with the right button selects the time range to export, a click clears it
+        auto drawingAreaSelectGesture = Gtk::GestureDrag::create();
+        drawingArea->add_controller(drawingAreaSelectGesture);
+        drawingAreaSelectGesture->set_button(GDK_BUTTON_SECONDARY);
+        drawingAreaSelectGesture->signal_drag_begin().connect([&plotSelection, drawingArea, builder](double, double){
+            plotSelection.reset();
+            if (!exporter)
+                builder->get_widget<Gtk::Button>("export-button")->set_label("Export");
+            drawingArea->queue_draw();
+        });
+        drawingAreaSelectGesture->signal_drag_update().connect([&plotView, &plotSelection, drawingAreaSelectGesture, drawingArea, builder](double offsetX, double){
+            if (offsetX == 0)
+                return;
+            double startX{}, startY{};
+            drawingAreaSelectGesture->get_start_point(startX, startY);
+            // Whole columns, from the one where the drag started to the one under the mouse
+            const int64_t lastBucket = plotView.getLastBucket(selectedHistory());
+            const auto [first, last] = std::minmax(
+                    PlotView::xToBucket((int)startX, lastBucket, drawingArea->get_width()),
+                    PlotView::xToBucket((int)(startX+offsetX), lastBucket, drawingArea->get_width()));
+            plotSelection = {plotView.getBucketStart(first), plotView.getBucketStart(last+1)};
+            if (!exporter)
+                builder->get_widget<Gtk::Button>("export-button")->set_label("Export range");
+            drawingArea->queue_draw();
+        });
+
         auto drawingAreaMotionController = Gtk::EventControllerMotion::create();
         drawingArea->add_controller(drawingAreaMotionController);
         drawingAreaMotionController->signal_motion().connect([&canvasMouseX, &canvasMouseY, builder](double x, double y){
-            //std::cout << "Move: x=" << x << ", y=" << y << '\n';
+            LOG_TRACE("Move: x={}, y={}", x, y);
             canvasMouseX = (int)x;
             canvasMouseY = (int)y;
             auto drawingArea = builder->get_widget<Gtk::DrawingArea>("plot-area");
@@ -228,69 +779,139 @@ int main(int argc, char** argv)
             drawingArea->queue_draw();
         }, false);
 
-        builder->get_widget<Gtk::Button>("export-button")->signal_clicked().connect([mainWindow](){
+        exportDispatcher.connect([&builder, &plotSelection](){
+            auto button = builder->get_widget<Gtk::Button>("export-button");
+            const char* const idleLabel = plotSelection ? "Export range" : "Export";
+            if (!exporter)
+            {
+                button->set_label(idleLabel);
+                return;
+            }
+
+            if (!exporter->isFinished())
+            {
+                const size_t rowCount = exporter->getRowCount();
+                button->set_label(std::format("Cancel ({}%)", rowCount ? exporter->getRowsWritten()*100/rowCount : 0));
+                return;
+            }
+
+            switch (exporter->getResult())
+            {
+                case CsvExporter::Result::Done:
+                    LOG_INFO("Exported {} rows to {}", exporter->getRowCount(), exporter->getPath());
+                    break;
+                case CsvExporter::Result::Cancelled:
+                    LOG_INFO("Export cancelled");
+                    break;
+                case CsvExporter::Result::Failed:
+                    LOG_ERROR("Failed to export to {}: {}", exporter->getPath(), exporter->getError());
+                    break;
+                case CsvExporter::Result::Running:
+                    break;
+            }
+            exporter.reset();
+            button->set_label(idleLabel);
+        });
+
+        builder->get_widget<Gtk::Button>("export-button")->signal_clicked().connect([mainWindow, &exportDispatcher, &plotSelection](){
+            // The button cancels the running export
+            if (exporter)
+            {
+                exporter->cancel();
+                return;
+            }
+
+            // The callback only gets a plain pointer, it deletes this
+            struct ExportRequest
+            {
+                Glib::Dispatcher* dispatcher{};
+                std::optional<std::pair<timestamp_t, timestamp_t>> range;
+            };
             GtkFileDialog* dialog = gtk_file_dialog_new();
-            gtk_file_dialog_save(dialog, mainWindow->gobj(), nullptr, [](GObject *source_object, GAsyncResult *res, gpointer){
+            gtk_file_dialog_save(dialog, mainWindow->gobj(), nullptr, [](GObject *source_object, GAsyncResult *res, gpointer userData){
+                const std::unique_ptr<ExportRequest> request{static_cast<ExportRequest*>(userData)};
                 GError** err = nullptr;
                 if (GFile* file = gtk_file_dialog_save_finish(GTK_FILE_DIALOG(source_object), res, err))
                 {
                     std::string path = g_file_get_path(file);
-                    std::cout << "Exporting to " << path << std::endl;
-                    exportData(path, frames);
+                    LOG_INFO("Exporting to {}", path);
+                    auto dispatcher = request->dispatcher;
+                    const History& history = selectedHistory();
+                    std::string preamble;
+                    if (selectedDevice < statistics.size())
+                    {
+                        // The statistics are kept for the session, a range gets them too but says so
+                        if (request->range)
+                            preamble = "# Session statistics, not of the exported rows only, the windows end at the newest reading\n";
+                        preamble += statistics[selectedDevice].formatTable(history, "# ");
+                    }
+                    exporter = std::make_unique<CsvExporter>(history.snapshot(), path, [dispatcher](){ dispatcher->emit(); }, preamble);
+                    if (request->range)
+                        exporter->setRange(history.findTime(request->range->first), history.findTime(request->range->second));
+                    exporter->start();
+                    dispatcher->emit();
                     g_object_unref(file);
                 }
                 if (err)
                 {
-                    std::cout << "File chooser error" << std::endl;
+                    LOG_ERROR("File chooser error");
                     g_error_free(*err);
                 }
-            }, nullptr);
+            }, new ExportRequest{&exportDispatcher, plotSelection});
+        });
+
+        // Only refreshed while it's open, the rates are over the time since the previous refresh
+        auto diagnosticsPopover = builder->get_widget<Gtk::Popover>("diagnostics-popover");
+        diagnosticsPopover->signal_show().connect([&builder, &diagnosticsRefresh](){
+            auto refresh{[&builder, counters=Diagnostics::Counters{}, time=Diagnostics::clock::now()-diagnostics.getUptime()]() mutable {
+                const Diagnostics::clock::time_point now = Diagnostics::clock::now();
+                builder->get_widget<Gtk::Label>("diagnostics-display")->set_label(diagnostics.formatTable(counters, now-time));
+                counters = diagnostics.getCounters();
+                time = now;
+                return true;
+            }};
+            refresh();
+            diagnosticsRefresh = Glib::signal_timeout().connect(refresh, 1000);
+        });
+        diagnosticsPopover->signal_hide().connect([&diagnosticsRefresh](){ diagnosticsRefresh.disconnect(); });
+
+        builder->get_widget<Gtk::Button>("diagnostics-dump-button")->signal_clicked().connect([](){
+            std::cout << diagnostics.formatJson() << std::endl;
         });
+#ifdef G_OS_UNIX
+        // `kill -USR1` dumps them too, for when there's no one at the GUI
+        g_unix_signal_add(SIGUSR1, [](gpointer){
+            std::cout << diagnostics.formatJson() << std::endl;
+            return gboolean{G_SOURCE_CONTINUE};
+        }, nullptr);
+#endif
 
         mainWindow->show();
     });
 
     app->signal_shutdown().connect([&](){
-        std::cout << "Shutting down\n";
-        stayConnected = false;
-        keepThreadAlive = false;
-        connThread.join();
-        std::cout << "Done\n";
-    });
-
-    dispatcher.connect([&](){
-        std::cout << "Updating GUI\n" << std::flush;
-
-        auto statDisp = builder->get_widget<Gtk::Label>("status-display");
-        statDisp->set_markup(std::format("<span foreground='{}'>{}</span>", connStatusGetColor(connStatus), connStatusToStr(connStatus)));
-
-        builder->get_widget<Gtk::Button>("connect-button")->set_label(connStatus == ConnStatus::Connected ? "DISCONNECT" : "CONNECT");
-
-        std::lock_guard<std::mutex> guard = std::lock_guard{framesMutex};
-        if (frames.empty())
-            return;
-        const Frame* const frame = frames.back().get();
-        const auto strVal = std::isnan(frame->getFloatVal()) ? "-------" : std::format("{:^ 3.3f}", frame->getFloatVal());
-        builder->get_widget<Gtk::Label>("lcd-display-1")->set_label(strVal);
-        builder->get_widget<Gtk::Label>("lcd-display-2")->set_label(frame->getUnitStr());
-
-        auto setActivateLabel{[&](const std::string& id, bool active){
-            auto widget = builder->get_widget<Gtk::Label>("status-label-"+id);
-            if (active) widget->add_css_class("status-label-active");
-            else widget->remove_css_class("status-label-active");
-        }};
-
-        setActivateLabel("auto", frame->AUTO);
-        setActivateLabel("dc", frame->DC);
-        setActivateLabel("ac", frame->AC);
-        setActivateLabel("diode", frame->diode);
-        setActivateLabel("beep", frame->beep);
-        setActivateLabel("hold", frame->hold);
-        setActivateLabel("rel", frame->rel);
-        setActivateLabel("batt", frame->battery);
-
-        builder->get_widget<Gtk::DrawingArea>("plot-area")->queue_draw();
-        return;
+        LOG_INFO("Shutting down");
+        if (deviceMonitor)
+            deviceMonitor->stop();
+        if (acquisition)
+            acquisition->stop();
+        // Writes the captures that are done
+        if (triggers)
+            triggers->stop();
+        if (streamServer)
+            streamServer->stop();
+        guiUpdates.reset();
+        // Cancels the export and the import
+        exporter.reset();
+        importer.reset();
+        if (plotRenderer)
+            plotRenderer->stopThread();
+        // The logger is destroyed before these globals, so their journals are closed while it can still write
+        acquisition.reset();
+        triggers.reset();
+        streamServer.reset();
+        LOG_INFO("Done");
+        logger.stop();
     });
 
     return app->run(argc, argv);
@@ -1,15 +1,22 @@
 #include <cassert>
-#include <iostream>
 #include <stdint.h>
 #include <chrono>
 #include <thread>
 #include <filesystem>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include "Log.h"
 #include "protocol.h"
+#include "simulator.h"
 #ifdef __linux__
 #   include <unistd.h>
 #   include <fcntl.h>
 #   include <termios.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
 #else
 #   include <Windows.h>
 #endif
@@ -17,6 +24,8 @@
 #define BAUDRATE 2400
 #define READ_MIN 14
 #define READ_TIMEOUT_USEC 1000000
+#define READ_BUF_SIZE 4096
+#define MAX_EVENTS 64
 
 std::string connStatusToStr(ConnStatus cs)
 {
@@ -63,15 +72,15 @@ struct PlatformState
 
 static int configurePort(PlatformState* state, const SerialDevice& dev)
 {
-    state->port = open(dev.path.c_str(), O_RDONLY | O_NOCTTY);
+    state->port = open(dev.path.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
 
     if (state->port == -1)
     {
-        std::cerr << "Failed to open port: " << strerror(errno) << '\n';
+        LOG_ERROR("Failed to open port {}: {}", dev.path, strerror(errno));
         return 1;
     }
 
-    std::cout << "Opened port, handle: " << state->port << '\n';
+    LOG_DEBUG("Opened port, handle: {}", state->port);
 
     state->oldTio = termios{};
     tcgetattr(state->port, &state->oldTio);
@@ -88,7 +97,7 @@ static int configurePort(PlatformState* state, const SerialDevice& dev)
     cfsetispeed(&newTio, B2400);
     tcsetattr(state->port, TCSANOW, &newTio);
 
-    std::cout << "Configured port\n";
+    LOG_DEBUG("Configured port");
 
     return 0;
 }
@@ -100,22 +109,22 @@ static int configurePort(PlatformState* state)
     state->port = CreateFile("\\\\.\\COM3", GENERIC_READ, 0, nullptr, OPEN_EXISTING, 0, nullptr);
     if (state->port == INVALID_HANDLE_VALUE)
     {
-        std::cerr << "Failed to open port (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to open port (code {})", GetLastError());
         return 1;
     }
-    std::cout << "Opened port, handle: " << state->port << '\n';
+    LOG_DEBUG("Opened port, handle: {}", static_cast<const void*>(state->port));
 
     COMMTIMEOUTS timeouts{};
     timeouts.ReadIntervalTimeout = READ_TIMEOUT_USEC/1000;
     if (SetCommTimeouts(state->port, &timeouts))
     {
-        std::cerr << "Failed to set port timeout (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to set port timeout (code {})", GetLastError());
         //return 1;
     }
 
     if (SetCommMask(state->port, EV_RXCHAR))
     {
-        std::cerr << "Failed to set communications mask (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to set communications mask (code {})", GetLastError());
         //return 1;
     }
 
@@ -124,18 +133,18 @@ static int configurePort(PlatformState* state)
     BOOL status = GetCommState(state->port, &dcbSerialParams);
     if (status == FALSE)
     {
-        std::cout << "Failed to get comm state (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to get comm state (code {})", GetLastError());
         //return 1;
     }
     dcbSerialParams.BaudRate = BAUDRATE;
     status = SetCommState(state->port, &dcbSerialParams);
     if (status == FALSE)
     {
-        std::cout << "Failed to set comm state (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to set comm state (code {})", GetLastError());
         //return 1;
     }
 
-    std::cout << "Configured port\n";
+    LOG_DEBUG("Configured port");
 
     return 0;
 }
@@ -148,15 +157,15 @@ void closePort(PlatformState* state)
 {
     if (tcsetattr(state->port, TCSANOW, &state->oldTio) == -1)
     {
-        std::cerr << "Failed to reset port configuration\n";
+        LOG_ERROR("Failed to reset port configuration: {}", strerror(errno));
     }
     if (close(state->port) == -1)
     {
-        std::cerr << "Failed to close port\n";
+        LOG_ERROR("Failed to close port: {}", strerror(errno));
     }
     else
     {
-        std::cout << "Closed port\n";
+        LOG_DEBUG("Closed port");
     }
     state->oldTio = {};
     state->port = -1;
@@ -169,11 +178,11 @@ void closePort(PlatformState* state)
     assert(state->port);
     if (CloseHandle(state->port) == 0)
     {
-        std::cerr << "Failed to close port (code " << GetLastError() << ")\n";
+        LOG_ERROR("Failed to close port (code {})", GetLastError());
     }
     else
     {
-        std::cout << "Closed port\n";
+        LOG_DEBUG("Closed port");
     }
     state->port = nullptr;
 }
@@ -182,148 +191,345 @@ void closePort(PlatformState* state)
 
 #ifdef __linux__
 
-static int readFrame(ConnStatus* connStatus, PlatformState* state, uint8_t* buf)
+struct AcquisitionEngine::Loop
 {
-    fd_set fdSet;
-    FD_ZERO(&fdSet);
-    FD_SET(state->port, &fdSet);
-    timeval timeout{.tv_usec = READ_TIMEOUT_USEC};
-    int retVal = select(state->port+1, &fdSet, nullptr, nullptr, &timeout);
-    if (retVal == -1)
+    struct ChannelIo
     {
-        std::cerr << "select() error: " << strerror(errno) << '\n';
-        *connStatus = ConnStatus::IOError;
-        return 1;
-    }
-    if (retVal == 0)
-    {
-        std::cerr << "Timed out" << '\n';
-        *connStatus = ConnStatus::Timeout;
-        return 1;
-    }
+        Channel* channel{};
+        SerialDevice device;
+        PlatformState state;
+        FrameDecoder decoder;
+        std::chrono::steady_clock::time_point deadline;
+
+        inline bool isOpen() const { return state.port != -1; }
+    };
+
+    std::thread thread;
+    int epollFd{-1};
+    // Signalled when a command is posted
+    int eventFd{-1};
+    std::vector<std::unique_ptr<ChannelIo>> channels;
+
+    std::mutex commandMutex;
+    std::vector<Command> commands;
+};
 
-    int count = read(state->port, buf, 255);
-    if (count == -1)
+// Marks the event of the command eventfd, the channels use their index
+static constexpr uint64_t COMMAND_EVENT = UINT64_MAX;
+
+AcquisitionEngine::AcquisitionEngine(NotifyFunc notify, size_t threadCount)
+    : notify{std::move(notify)}
+{
+    // The devices come later, so the number of threads is fixed up front
+    threadCount = std::max<size_t>(1, threadCount);
+    for (size_t i{}; i < threadCount; ++i)
+        loops.push_back(std::make_unique<Loop>());
+}
+
+AcquisitionEngine::~AcquisitionEngine()
+{
+    stop();
+}
+
+void AcquisitionEngine::start()
+{
+    for (auto& loop : loops)
     {
-        std::cerr << "I/O error: " << strerror(errno) << '\n';
-        *connStatus = ConnStatus::IOError;
-        return 1;
+        if (loop->thread.joinable())
+            continue;
+
+        loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        loop->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epollFd == -1 || loop->eventFd == -1)
+        {
+            LOG_ERROR("Failed to create I/O loop: {}", strerror(errno));
+            continue;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = COMMAND_EVENT;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->eventFd, &event);
+
+        loop->thread = std::thread{&AcquisitionEngine::runLoop, this, std::ref(*loop)};
+        // Picks up the commands that were posted before the start
+        const uint64_t one = 1;
+        if (write(loop->eventFd, &one, sizeof(one)) == -1)
+            LOG_ERROR("Failed to signal I/O loop: {}", strerror(errno));
     }
-    if (count == 0)
+}
+
+void AcquisitionEngine::stop()
+{
+    for (auto& loop : loops)
     {
-        std::cout << "EOF\n";
-        *connStatus = ConnStatus::Eof;
-        closePort(state);
-        return 1;
+        if (loop->thread.joinable())
+        {
+            postCommand(*loop, {.type=Command::Type::Shutdown});
+            loop->thread.join();
+        }
+        if (loop->epollFd != -1)
+            close(loop->epollFd);
+        if (loop->eventFd != -1)
+            close(loop->eventFd);
+        loop->epollFd = -1;
+        loop->eventFd = -1;
     }
-    return 0;
 }
 
-#else
+size_t AcquisitionEngine::addChannel(const SerialDevice& device, std::unique_ptr<JournalWriter> journal,
+        TriggerEngine::Channel* triggers, StreamServer::Channel* stream)
+{
+    const size_t index = channels.size();
+    auto channel = std::make_unique<Channel>();
+    channel->device = device;
+    channel->journal = std::move(journal);
+    channel->triggers = triggers;
+    channel->stream = stream;
+    // The loop takes its own copy of the device, the channel keeps the one the GUI sees
+    postCommand(*loops[index % loops.size()],
+            {.type=Command::Type::AddChannel, .channel=index/loops.size(), .device=device, .added=channel.get()});
+    channels.push_back(std::move(channel));
+    return index;
+}
 
-static int readFrame(ConnStatus* connStatus, PlatformState* state, uint8_t* buf)
+void AcquisitionEngine::connect(size_t channel)
+{
+    postCommand(*loops[channel % loops.size()], {.type=Command::Type::Connect, .channel=channel/loops.size()});
+}
+
+void AcquisitionEngine::disconnect(size_t channel)
+{
+    postCommand(*loops[channel % loops.size()], {.type=Command::Type::Disconnect, .channel=channel/loops.size()});
+}
+
+void AcquisitionEngine::switchDevice(size_t channel, const SerialDevice& device)
+{
+    channels[channel]->device = device;
+    postCommand(*loops[channel % loops.size()],
+            {.type=Command::Type::SwitchDevice, .channel=channel/loops.size(), .device=device});
+}
+
+void AcquisitionEngine::postCommand(Loop& loop, Command command)
 {
-    DWORD dwEventMask;
-	BOOL status = WaitCommEvent(state->port, &dwEventMask, nullptr);
-	if (status == FALSE)
-    {
-        std::cout << "WaitCommEvent failed\n";
-        closePort(state);
-        *connStatus = ConnStatus::IOError;
-		return 1;
-	}
-
-    DWORD bytesRead;
-	status = ReadFile(state->port, buf, READ_MIN, &bytesRead, nullptr);
-	if (status == FALSE)
-    {
-        std::cout << "ReadFile failed\n";
-        closePort(state);
-        *connStatus = ConnStatus::IOError;
-		return 1;
-	}
-    if (bytesRead == 0)
     {
-        std::cout << "EOF\n";
-        closePort(state);
-        *connStatus = ConnStatus::Eof;
-		return 1;
+        const std::unique_lock<std::mutex> guard = diagnostics.lock(loop.commandMutex);
+        loop.commands.push_back(std::move(command));
     }
-    return 0;
+    // Not started yet, `start` signals it
+    if (loop.eventFd == -1)
+        return;
+    const uint64_t one = 1;
+    if (write(loop.eventFd, &one, sizeof(one)) == -1)
+        LOG_ERROR("Failed to signal I/O loop: {}", strerror(errno));
 }
 
-#endif
-
-void startReadingData(
-        const std::atomic<bool>& keepThreadAlive, std::atomic<bool>& stayConnected, ConnStatus& connStatus,
-        std::vector<std::unique_ptr<Frame>>& frames, std::mutex& framesMutex,
-        Glib::Dispatcher& dispatcher, const SerialDevice& device)
+void AcquisitionEngine::runLoop(Loop& loop)
 {
-    std::cout << "Thread 0x" << std::hex << std::this_thread::get_id() << std::dec << " started\n";
-    std::cout << "Active serial device: " << device.path << '\n';
+    LOG_DEBUG("I/O thread started");
 
-    /*
-     * while keepThreadAlive:
-     *    while !stayConnected
-     *    do setup
-     *    while stayConnected
-     */
+    const auto openChannel{[&](Loop::ChannelIo& io, size_t index){
+        LOG_INFO("Connecting to {}", io.device.path);
+        io.channel->status = ConnStatus::Connecting;
+        notify();
 
-    while (keepThreadAlive)
+        if (configurePort(&io.state, io.device))
+        {
+            io.channel->status = ConnStatus::FailedToOpen;
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = index;
+        epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, io.state.port, &event);
+        io.deadline = std::chrono::steady_clock::now()+std::chrono::microseconds{READ_TIMEOUT_USEC};
+        io.channel->status = ConnStatus::Connected;
+    }};
+
+    const auto closeChannel{[&](Loop::ChannelIo& io, ConnStatus status){
+        epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, io.state.port, nullptr);
+        closePort(&io.state);
+        io.decoder.reset();
+        if (io.channel->journal)
+            io.channel->journal->sync();
+        io.channel->status = status;
+    }};
+
+    uint8_t buf[READ_BUF_SIZE];
+    epoll_event events[MAX_EVENTS];
+    std::vector<Command> commands;
+    bool running = true;
+    while (running)
     {
-        // Wait until a connection is requested
-        while (!stayConnected && keepThreadAlive)
+        // Only wake up for the closest read timeout, sleep indefinitely when idle
+        auto now = std::chrono::steady_clock::now();
+        std::optional<std::chrono::steady_clock::time_point> wakeup;
+        for (const auto& io : loop.channels)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            if (io->isOpen())
+                wakeup = wakeup ? std::min(*wakeup, io->deadline) : io->deadline;
         }
+        const int timeout = wakeup
+            ? std::max<int>(0, std::chrono::ceil<std::chrono::milliseconds>(*wakeup-now).count())
+            : -1;
 
-        connStatus = ConnStatus::Connecting;
-        dispatcher.emit();
-
-        PlatformState state;
-        if (configurePort(&state, device))
+        const int eventCount = epoll_wait(loop.epollFd, events, MAX_EVENTS, timeout);
+        if (eventCount == -1)
         {
-           connStatus = ConnStatus::FailedToOpen;
-           dispatcher.emit();
-           stayConnected = false;
-           continue;
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait() error: {}", strerror(errno));
+            break;
         }
 
-        uint8_t buf[255]{};
-
-        std::cout << "Configured port\n";
-
-        connStatus = ConnStatus::Connected;
-        dispatcher.emit();
-        while (true)
+        now = std::chrono::steady_clock::now();
+        const timestamp_t timestamp = std::chrono::system_clock::now();
+        bool gotFrame{};
+        bool changed{};
+        for (int i{}; i < eventCount; ++i)
         {
-            if (!stayConnected || !keepThreadAlive)
+            if (events[i].data.u64 == COMMAND_EVENT)
             {
-                std::cout << "Connection closed by user\n";
-                closePort(&state);
-                connStatus = ConnStatus::Closed;
-                dispatcher.emit();
-                break;
+                uint64_t value;
+                if (read(loop.eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                    LOG_LIMITED(Error, std::chrono::seconds{1}, "Failed to read eventfd: {}", strerror(errno));
+                {
+                    const std::unique_lock<std::mutex> guard = diagnostics.lock(loop.commandMutex);
+                    std::swap(commands, loop.commands);
+                }
+
+                for (Command& command : commands)
+                {
+                    if (command.type == Command::Type::Shutdown)
+                    {
+                        running = false;
+                        continue;
+                    }
+                    if (command.type == Command::Type::AddChannel)
+                    {
+                        // The commands of a loop are in order, so the index is the next one
+                        assert(command.channel == loop.channels.size());
+                        loop.channels.push_back(std::make_unique<Loop::ChannelIo>(Loop::ChannelIo{
+                                .channel=command.added, .device=std::move(command.device), .state={},
+                                .decoder=FrameDecoder{command.added->ingest.decoderStats}, .deadline={}}));
+                        continue;
+                    }
+
+                    Loop::ChannelIo& io = *loop.channels[command.channel];
+                    switch (command.type)
+                    {
+                    case Command::Type::Connect:
+                        if (!io.isOpen())
+                            openChannel(io, command.channel);
+                        break;
+
+                    case Command::Type::Disconnect:
+                        if (io.isOpen())
+                        {
+                            LOG_INFO("Connection to {} closed by user", io.device.path);
+                            closeChannel(io, ConnStatus::Closed);
+                        }
+                        break;
+
+                    case Command::Type::SwitchDevice:
+                    {
+                        LOG_INFO("Switching {} to {}", io.device.path, command.device.path);
+                        const bool wasOpen = io.isOpen();
+                        if (wasOpen)
+                            closeChannel(io, ConnStatus::Closed);
+                        io.device = std::move(command.device);
+                        if (wasOpen)
+                            openChannel(io, command.channel);
+                        break;
+                    }
+
+                    case Command::Type::AddChannel:
+                    case Command::Type::Shutdown:
+                        break;
+                    }
+                    changed = true;
+                }
+                commands.clear();
+                continue;
             }
 
-            if (readFrame(&connStatus, &state, buf))
+            Loop::ChannelIo& io = *loop.channels[events[i].data.u64];
+            if (!io.isOpen())
+                continue;
+
+            const Diagnostics::clock::time_point readStart = Diagnostics::clock::now();
+            const ssize_t count = read(io.state.port, buf, sizeof(buf));
+            const Diagnostics::clock::time_point received = Diagnostics::clock::now();
+            diagnostics.record(Diagnostics::Stage::Read, received-readStart);
+            if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+            if (count == -1)
             {
-                dispatcher.emit();
-                stayConnected = false;
-                break;
+                LOG_ERROR("{}: I/O error: {}", io.device.path, strerror(errno));
+                closeChannel(io, ConnStatus::IOError);
+                changed = true;
+                continue;
             }
+            if (count == 0)
+            {
+                LOG_WARNING("{}: EOF", io.device.path);
+                closeChannel(io, ConnStatus::Eof);
+                changed = true;
+                continue;
+            }
+
+            io.deadline = now+std::chrono::microseconds{READ_TIMEOUT_USEC};
+            IngestQueue& ingest = io.channel->ingest;
+            size_t frameCount{};
+            io.decoder.feed(buf, count, [&](const uint8_t bytes[14]){
+                RawFrame frame{};
+                frame.timestamp = timestamp;
+                frame.received = received;
+                std::copy(bytes, bytes+14, frame.bytes);
+                // Before the frame is queued, so the rules never wait for the GUI either
+                if (io.channel->triggers)
+                {
+                    io.channel->triggers->process(bytes, timestamp);
+                    diagnostics.recordSince(Diagnostics::Stage::Trigger, received);
+                }
+                // Never wait for the GUI, the frame is dropped if the queue is full
+                ingest.ring.tryPush(frame);
+                if (io.channel->journal)
+                    io.channel->journal->append(bytes, timestamp);
+                if (io.channel->stream)
+                    io.channel->stream->publish(bytes, timestamp);
+                ++frameCount;
+            });
+            diagnostics.recordSince(Diagnostics::Stage::Decode, received);
+            diagnostics.countFrames(frameCount);
+            if (frameCount && !ingest.wakeupPending.exchange(true))
+                gotFrame = true;
+        }
 
-            auto frame = std::make_unique<Frame>(buf, std::chrono::system_clock::now());
+        for (const auto& io : loop.channels)
+        {
+            if (io->isOpen() && now >= io->deadline)
             {
-                std::lock_guard<std::mutex> guard = std::lock_guard{framesMutex};
-                frames.push_back(std::move(frame));
+                LOG_WARNING("{}: Timed out", io->device.path);
+                closeChannel(*io, ConnStatus::Timeout);
+                changed = true;
             }
-            dispatcher.emit();
         }
+
+        if (gotFrame || changed)
+            notify();
+    }
+
+    for (const auto& io : loop.channels)
+    {
+        if (io->isOpen())
+            closeChannel(*io, ConnStatus::Closed);
     }
-    std::cout << "Thread 0x" << std::hex << std::this_thread::get_id() << std::dec << " exited\n";
+    notify();
+    LOG_DEBUG("I/O thread exited");
 }
 
+#endif
+
 static std::string readLine(const std::filesystem::path& path)
 {
     std::ifstream file{path};
@@ -333,24 +539,50 @@ static std::string readLine(const std::filesystem::path& path)
     return output;
 }
 
+std::string SerialDevice::getKey() const
+{
+    return manufacturer+'\n'+product+'\n'+(serial.empty() ? path : serial);
+}
+
 std::vector<SerialDevice> listSerialDevices()
 {
     std::vector<SerialDevice> output;
-    std::filesystem::directory_iterator dirIter{"/sys/class/tty"};
-    for (const auto& file : dirIter)
+    // Devices may be unplugged while this runs, those are skipped instead of throwing
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator{"/sys/class/tty", error})
     {
         if (!file.path().filename().string().starts_with("ttyUSB"))
             continue;
 
-        const auto sysDevPath = std::filesystem::canonical(std::filesystem::canonical(file)/"../../../..");
+        const auto ttyPath = std::filesystem::canonical(file.path(), error);
+        if (error)
+            continue;
+        const auto sysDevPath = std::filesystem::canonical(ttyPath/"../../../..", error);
+        if (error)
+            continue;
 
         output.push_back({
                 .manufacturer=readLine(sysDevPath/"manufacturer"),
                 .product=readLine(sysDevPath/"product"),
+                .serial=readLine(sysDevPath/"serial"),
                 .path="/dev"/file.path().filename()
         });
     }
+
+    // Running simulators, the links of the exited ones are dangling
+    for (const auto& file : std::filesystem::directory_iterator{simulatorDeviceDir(), error})
+    {
+        if (!std::filesystem::exists(file.path(), error))
+            continue;
+        output.push_back({
+                .manufacturer="mx-ui",
+                .product="Simulator "+file.path().filename().string(),
+                .serial={},
+                .path=file.path()
+        });
+    }
+
     std::sort(output.begin(), output.end(),
-            [](const auto& x, const auto& y){ return x.path.compare(y.path); });
+            [](const auto& x, const auto& y){ return x.path < y.path; });
     return output;
 }
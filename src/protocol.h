@@ -2,10 +2,16 @@
 
 #include <vector>
 #include <memory>
-#include <mutex>
-#include <glibmm/dispatcher.h>
+#include <atomic>
+#include <functional>
 #include <gdkmm/rgba.h>
-#include "Frame.h"
+#include "Diagnostics.h"
+#include "History.h"
+#include "SpscRing.h"
+#include "FrameDecoder.h"
+#include "Journal.h"
+#include "StreamServer.h"
+#include "Trigger.h"
 
 enum class ConnStatus
 {
@@ -25,12 +31,105 @@ struct SerialDevice
 {
     std::string manufacturer;
     std::string product;
+    // Empty if the device doesn't have one
+    std::string serial;
     std::string path;
+
+    // Identifies the device even after it's plugged into another port.
+    // Without a serial number, identical devices can only be told apart by the port.
+    std::string getKey() const;
 };
 
 std::vector<SerialDevice> listSerialDevices();
 
-void startReadingData(
-        const std::atomic<bool>& keepThreadAlive, std::atomic<bool>& stayConnected, ConnStatus& connStatus,
-        std::vector<std::unique_ptr<Frame>>& frames, std::mutex& framesMutex,
-        Glib::Dispatcher& dispatcher, const SerialDevice& device);
+struct RawFrame
+{
+    timestamp_t timestamp;
+    // When it was read, for measuring the latency
+    Diagnostics::clock::time_point received;
+    uint8_t bytes[14];
+};
+
+// Carries the frames from the reader thread to the GUI thread
+struct IngestQueue
+{
+    SpscRing<RawFrame, 1 << 14> ring;
+    // Set when the reader emitted the dispatcher, cleared by the GUI thread before draining
+    std::atomic<bool> wakeupPending{};
+    DecoderStats decoderStats;
+};
+
+/*
+ * Reads any number of serial devices.
+ *
+ * The devices are spread over a few I/O threads, each of them waits for all
+ * of its ports with a single epoll. Every device has its own channel with its
+ * own queue of frames and connection status.
+ * The I/O threads are controlled by commands, they sleep until a command or
+ * data arrives, or a connection times out.
+ */
+class AcquisitionEngine
+{
+public:
+    struct Channel
+    {
+        SerialDevice device;
+        IngestQueue ingest;
+        std::atomic<ConnStatus> status{ConnStatus::Closed};
+        // Records every frame when set, only used by the I/O thread once the channel is added
+        std::unique_ptr<JournalWriter> journal;
+        // Evaluates the trigger rules on every frame when set, owned by the trigger engine
+        TriggerEngine::Channel* triggers{};
+        // Sends every frame to the stream clients when set, owned by the stream server
+        StreamServer::Channel* stream{};
+    };
+
+    // Called from the I/O threads when there are new frames or a status changed
+    using NotifyFunc = std::function<void()>;
+
+    AcquisitionEngine(NotifyFunc notify, size_t threadCount=1);
+    ~AcquisitionEngine();
+
+    void start();
+    // Closes all the ports and waits for the I/O threads to exit
+    void stop();
+
+    // These return immediately, the command is carried out by the I/O thread.
+    // Adds a closed channel for the device and returns its index, channels are never removed.
+    size_t addChannel(const SerialDevice& device, std::unique_ptr<JournalWriter> journal={},
+            TriggerEngine::Channel* triggers=nullptr, StreamServer::Channel* stream=nullptr);
+    void connect(size_t channel);
+    void disconnect(size_t channel);
+    // Moves the channel to another port, reconnecting if it was connected
+    void switchDevice(size_t channel, const SerialDevice& device);
+
+    inline size_t getChannelCount() const { return channels.size(); }
+    inline Channel& getChannel(size_t i) { return *channels[i]; }
+
+private:
+    struct Command
+    {
+        enum class Type
+        {
+            AddChannel,
+            Connect,
+            Disconnect,
+            SwitchDevice,
+            Shutdown,
+        } type;
+        // Index in the loop
+        size_t channel{};
+        SerialDevice device{};
+        // The new channel of `AddChannel`
+        Channel* added{};
+    };
+
+    struct Loop;
+
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::vector<std::unique_ptr<Loop>> loops;
+    NotifyFunc notify;
+
+    void postCommand(Loop& loop, Command command);
+    void runLoop(Loop& loop);
+};
@@ -0,0 +1,437 @@
+/*
+ * Simulates a multimeter on a pseudo-terminal.
+ *
+ * The frames are generated from a waveform (or a script of waveforms) or
+ * replayed from a recorded journal, optionally with noise and bad digits
+ * mixed in. The pty is linked into `simulatorDeviceDir()`, so mx-ui lists it
+ * like any other serial device. There is no baud rate on a pty, so the frame
+ * rate is only limited by how fast the reader keeps up.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <optional>
+#include <cmath>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <getopt.h>
+#include <termios.h>
+#include <unistd.h>
+#include "Frame.h"
+#include "Journal.h"
+#include "simulator.h"
+
+enum class Shape
+{
+    Const,
+    Sine,
+    Square,
+    Triangle,
+    Saw,
+    Random,
+};
+
+struct Segment
+{
+    // Zero means forever
+    double duration{};
+    Shape shape{Shape::Sine};
+    double amplitude{1};
+    double offset{};
+    double period{10};
+};
+
+struct Options
+{
+    std::string name = "sim0";
+    double rate = 4;
+    std::vector<Segment> script{Segment{}};
+    Frame::Unit unit{Frame::Unit::Prefix::None, Frame::Unit::Base::Volt};
+    double noise{};
+    double badDigits{};
+    std::string replayPath;
+    double speed = 1;
+    bool loop{};
+    uint64_t count{};
+    uint32_t seed = 1;
+};
+
+static volatile std::sig_atomic_t stopRequested{};
+
+static std::optional<Shape> parseShape(const std::string& str)
+{
+    if (str == "const")     return Shape::Const;
+    if (str == "sine")      return Shape::Sine;
+    if (str == "square")    return Shape::Square;
+    if (str == "triangle")  return Shape::Triangle;
+    if (str == "saw")       return Shape::Saw;
+    if (str == "random")    return Shape::Random;
+    return {};
+}
+
+static std::optional<Frame::Unit> parseUnit(const std::string& str)
+{
+    using Prefix = Frame::Unit::Prefix;
+    using Base = Frame::Unit::Base;
+
+    static const std::pair<std::string, Base> bases[]{
+        {"V", Base::Volt}, {"ohm", Base::Ohm}, {"F", Base::Farad}, {"Hz", Base::Hertz},
+        {"%", Base::Percent}, {"C", Base::Celsius}, {"A", Base::Ampere},
+    };
+    static const std::pair<char, Prefix> prefixes[]{
+        {'n', Prefix::Nano}, {'u', Prefix::Micro}, {'m', Prefix::Milli}, {'k', Prefix::Kilo}, {'M', Prefix::Mega},
+    };
+
+    for (const auto& [baseStr, base] : bases)
+    {
+        if (str == baseStr)
+            return Frame::Unit{Prefix::None, base};
+        if (str.size() != baseStr.size()+1 || !str.ends_with(baseStr))
+            continue;
+        for (const auto& [prefixChar, prefix] : prefixes)
+        {
+            if (str[0] == prefixChar)
+                return Frame::Unit{prefix, base};
+        }
+    }
+    return {};
+}
+
+// One segment per line: duration (s), shape, amplitude, offset, period (s), '#' starts a comment
+static bool loadScript(const std::string& path, std::vector<Segment>& script)
+{
+    std::ifstream file{path};
+    if (!file)
+    {
+        std::cerr << "Failed to open script: " << path << '\n';
+        return false;
+    }
+
+    script.clear();
+    std::string line;
+    for (int lineNum=1; std::getline(file, line); ++lineNum)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream{line};
+        Segment segment;
+        std::string shape;
+        if (!(stream >> segment.duration))
+            continue;
+        stream >> shape >> segment.amplitude >> segment.offset >> segment.period;
+        const auto parsedShape = parseShape(shape);
+        if (stream.fail() || !parsedShape)
+        {
+            std::cerr << path << ':' << lineNum << ": Invalid segment\n";
+            return false;
+        }
+        segment.shape = *parsedShape;
+        script.push_back(segment);
+    }
+    if (script.empty())
+    {
+        std::cerr << path << ": Empty script\n";
+        return false;
+    }
+    return true;
+}
+
+static double evalSegment(const Segment& segment, double time, std::mt19937& rng)
+{
+    const double phase = segment.period > 0 ? std::fmod(time/segment.period, 1.0) : 0;
+    double unit{};
+    switch (segment.shape)
+    {
+    case Shape::Const:      unit = 1; break;
+    case Shape::Sine:       unit = std::sin(phase*2*M_PI); break;
+    case Shape::Square:     unit = phase < 0.5 ? 1 : -1; break;
+    case Shape::Triangle:   unit = phase < 0.5 ? phase*4-1 : 3-phase*4; break;
+    case Shape::Saw:        unit = phase*2-1; break;
+    case Shape::Random:     unit = std::uniform_real_distribution<double>{-1, 1}(rng); break;
+    }
+    return segment.offset+segment.amplitude*unit;
+}
+
+class Simulator
+{
+public:
+    Simulator(const Options& options)
+        : options{options}, rng{options.seed}
+    {
+    }
+
+    ~Simulator()
+    {
+        if (!linkPath.empty())
+            std::filesystem::remove(linkPath);
+        if (slave != -1)
+            close(slave);
+        if (master != -1)
+            close(master);
+    }
+
+    bool open()
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+        {
+            std::cerr << "Failed to create pty: " << strerror(errno) << '\n';
+            return false;
+        }
+        const std::string slavePath = ptsname(master);
+
+        // Keeping the slave open makes the pty survive the reader closing it,
+        // and raw mode keeps the line discipline from mangling or echoing the bytes
+        slave = ::open(slavePath.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        termios tio{};
+        if (slave == -1 || tcgetattr(slave, &tio) == -1)
+        {
+            std::cerr << "Failed to open " << slavePath << ": " << strerror(errno) << '\n';
+            return false;
+        }
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        // Like a serial line, nobody waits for a reader
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+        std::error_code error;
+        std::filesystem::create_directories(simulatorDeviceDir(), error);
+        linkPath = simulatorDeviceDir()/options.name;
+        std::filesystem::remove(linkPath, error);
+        std::filesystem::create_symlink(slavePath, linkPath, error);
+        if (error)
+        {
+            std::cerr << "Failed to create link " << linkPath << ": " << error.message() << '\n';
+            linkPath.clear();
+        }
+        std::cout << "Simulating on " << slavePath << (linkPath.empty() ? "" : " ("+linkPath.string()+")") << '\n';
+        return true;
+    }
+
+    void run()
+    {
+        if (options.replayPath.empty())
+            runGenerator();
+        else
+            runReplay();
+        std::cout << "Sent " << sentFrames << " frames, dropped " << droppedFrames << " (no reader)\n";
+    }
+
+private:
+    const Options& options;
+    std::mt19937 rng;
+    int master{-1};
+    int slave{-1};
+    std::filesystem::path linkPath;
+    std::vector<uint8_t> out;
+    uint64_t sentFrames{};
+    uint64_t droppedFrames{};
+
+    bool chance(double probability)
+    {
+        return probability > 0 && std::uniform_real_distribution<double>{0, 1}(rng) < probability;
+    }
+
+    void addFrame(std::array<uint8_t, 14> buf)
+    {
+        if (chance(options.noise))
+        {
+            const int length = std::uniform_int_distribution<int>{1, 20}(rng);
+            for (int i{}; i < length; ++i)
+                out.push_back(rng());
+        }
+        if (chance(options.badDigits))
+        {
+            // A segment pattern that is not a digit
+            const int digit = std::uniform_int_distribution<int>{0, 3}(rng);
+            buf[1+digit*2] = (buf[1+digit*2] & 0xf8) | 0b100;
+            buf[2+digit*2] = (buf[2+digit*2] & 0xf0) | 0b0001;
+        }
+        out.insert(out.end(), buf.begin(), buf.end());
+    }
+
+    // Writes what the pty takes, the frames that don't fit are lost
+    void flush(size_t frameCount)
+    {
+        const ssize_t written = write(master, out.data(), out.size());
+        if (written == ssize_t(out.size()))
+            sentFrames += frameCount;
+        else
+            droppedFrames += frameCount;
+        out.clear();
+    }
+
+    void runGenerator()
+    {
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const std::chrono::duration<double> framePeriod{1/options.rate};
+        // At high rates frames are sent in batches instead of sleeping between them
+        constexpr auto minSleep = std::chrono::milliseconds{1};
+
+        size_t segmentIndex{};
+        double segmentStart{};
+        uint64_t frameNum{};
+        while (!stopRequested && (!options.count || frameNum < options.count))
+        {
+            const auto now = clock::now();
+            const uint64_t due = std::chrono::duration<double>(now-start)/framePeriod+1;
+            size_t frameCount{};
+            for (; frameNum < due && (!options.count || frameNum < options.count); ++frameNum)
+            {
+                const double time = frameNum*framePeriod.count();
+                while (options.script[segmentIndex].duration > 0 && time-segmentStart >= options.script[segmentIndex].duration)
+                {
+                    segmentStart += options.script[segmentIndex].duration;
+                    segmentIndex = (segmentIndex+1) % options.script.size();
+                }
+                const float value = evalSegment(options.script[segmentIndex], time-segmentStart, rng);
+                addFrame(Frame::encode(value, options.unit));
+                ++frameCount;
+            }
+            if (frameCount)
+                flush(frameCount);
+
+            const auto next = start+std::chrono::duration_cast<clock::duration>(framePeriod*frameNum);
+            std::this_thread::sleep_until(std::max(next, clock::now()+minSleep));
+        }
+    }
+
+    void runReplay()
+    {
+        JournalReader journal;
+        if (!journal.open(options.replayPath))
+            return;
+        std::cout << "Replaying " << journal.size() << " frames\n";
+
+        do
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i{}; i < journal.size() && !stopRequested; ++i)
+            {
+                const auto offset = std::chrono::duration<double>(journal.getTimestamp(i)-journal.getTimestamp(0))/options.speed;
+                std::this_thread::sleep_until(start+std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+
+                std::array<uint8_t, 14> buf;
+                std::copy_n(journal.getBytes(i), 14, buf.begin());
+                addFrame(buf);
+                flush(1);
+            }
+        } while (options.loop && !stopRequested);
+    }
+};
+
+static void printUsage(const char* argv0)
+{
+    std::cout << "Usage: " << argv0 << " [OPTION]...\n"
+        "Simulate a multimeter on a pseudo-terminal.\n\n"
+        "  -n, --name NAME        name of the device (default: sim0)\n"
+        "  -r, --rate HZ          frames per second (default: 4)\n"
+        "  -w, --wave SHAPE       const, sine, square, triangle, saw or random (default: sine)\n"
+        "  -a, --amplitude VALUE  amplitude of the wave (default: 1)\n"
+        "  -O, --offset VALUE     offset of the wave (default: 0)\n"
+        "  -p, --period SECONDS   period of the wave (default: 10)\n"
+        "  -s, --script FILE      play the segments in FILE in a loop, one per line:\n"
+        "                         DURATION SHAPE AMPLITUDE OFFSET PERIOD\n"
+        "  -u, --unit UNIT        e.g. V, mV, A, kohm, Hz, uF, C, % (default: V)\n"
+        "  -N, --noise P          probability of garbage bytes before a frame\n"
+        "  -b, --bad-digits P     probability of an invalid digit in a frame\n"
+        "  -R, --replay FILE      replay a recorded journal with its original timing\n"
+        "  -S, --speed FACTOR     replay speed (default: 1)\n"
+        "  -l, --loop             restart the replay at the end\n"
+        "  -c, --count N          stop after N frames\n"
+        "      --seed N           seed of the random numbers\n"
+        "  -h, --help             show this help\n";
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    Segment wave;
+    std::string scriptPath;
+
+    static const option longOptions[]{
+        {"name",        required_argument,  nullptr, 'n'},
+        {"rate",        required_argument,  nullptr, 'r'},
+        {"wave",        required_argument,  nullptr, 'w'},
+        {"amplitude",   required_argument,  nullptr, 'a'},
+        {"offset",      required_argument,  nullptr, 'O'},
+        {"period",      required_argument,  nullptr, 'p'},
+        {"script",      required_argument,  nullptr, 's'},
+        {"unit",        required_argument,  nullptr, 'u'},
+        {"noise",       required_argument,  nullptr, 'N'},
+        {"bad-digits",  required_argument,  nullptr, 'b'},
+        {"replay",      required_argument,  nullptr, 'R'},
+        {"speed",       required_argument,  nullptr, 'S'},
+        {"loop",        no_argument,        nullptr, 'l'},
+        {"count",       required_argument,  nullptr, 'c'},
+        {"seed",        required_argument,  nullptr, 1},
+        {"help",        no_argument,        nullptr, 'h'},
+        {},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:w:a:O:p:s:u:N:b:R:S:lc:h", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': options.name = optarg; break;
+        case 'r': options.rate = std::atof(optarg); break;
+        case 'w':
+            if (const auto shape = parseShape(optarg))
+            {
+                wave.shape = *shape;
+                break;
+            }
+            std::cerr << "Unknown wave shape: " << optarg << '\n';
+            return 1;
+        case 'a': wave.amplitude = std::atof(optarg); break;
+        case 'O': wave.offset = std::atof(optarg); break;
+        case 'p': wave.period = std::atof(optarg); break;
+        case 's': scriptPath = optarg; break;
+        case 'u':
+            if (const auto unit = parseUnit(optarg))
+            {
+                options.unit = *unit;
+                break;
+            }
+            std::cerr << "Unknown unit: " << optarg << '\n';
+            return 1;
+        case 'N': options.noise = std::atof(optarg); break;
+        case 'b': options.badDigits = std::atof(optarg); break;
+        case 'R': options.replayPath = optarg; break;
+        case 'S': options.speed = std::atof(optarg); break;
+        case 'l': options.loop = true; break;
+        case 'c': options.count = std::strtoull(optarg, nullptr, 10); break;
+        case 1: options.seed = std::strtoul(optarg, nullptr, 10); break;
+        case 'h': printUsage(argv[0]); return 0;
+        default: printUsage(argv[0]); return 1;
+        }
+    }
+
+    if (options.rate <= 0 || options.speed <= 0)
+    {
+        std::cerr << "The rate and the speed must be positive\n";
+        return 1;
+    }
+    options.script = {wave};
+    if (!scriptPath.empty() && !loadScript(scriptPath, options.script))
+        return 1;
+
+    const auto onSignal{[](int){ stopRequested = true; }};
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    Simulator simulator{options};
+    if (!simulator.open())
+        return 1;
+    simulator.run();
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <filesystem>
+#include <cstdlib>
+#include <unistd.h>
+
+// The simulators put a link to their pseudo-terminal here, `listSerialDevices` lists them
+inline std::filesystem::path simulatorDeviceDir()
+{
+    if (const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR"))
+        return std::filesystem::path{runtimeDir}/"mx-ui-sim";
+    return std::filesystem::temp_directory_path()/("mx-ui-sim-"+std::to_string(getuid()));
+}